@@ -0,0 +1,7 @@
+#pragma once
+
+#include <sklkphy/common.hpp>
+
+// Every translation unit including armadillo must agree on the preallocation size
+#define ARMA_MAT_PREALLOC (SKLK_PHY_MAX_RADIOS*SKLK_PHY_MAX_MIMO_USERS)
+#include <armadillo>
@@ -0,0 +1,424 @@
+#include "batched_kernels.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+#if defined(__x86_64__)
+#    include <immintrin.h>
+#endif
+
+////////////////////////////////////////////////////////////////////
+// Scalar reference kernels
+////////////////////////////////////////////////////////////////////
+static void scalar_dot_conj(const float *a_re, const float *a_im, const float *b_re, const float *b_im, size_t n, float &re, float &im)
+{
+    float acc_re{};
+    float acc_im{};
+    for (size_t i = 0; i < n; i++) {
+        acc_re += a_re[i]*b_re[i] + a_im[i]*b_im[i];
+        acc_im += a_im[i]*b_re[i] - a_re[i]*b_im[i];
+    }
+    re = acc_re;
+    im = acc_im;
+}
+
+static void scalar_sub_scaled(float alpha_re, float alpha_im, const float *x_re, const float *x_im, float *y_re, float *y_im, size_t n)
+{
+    for (size_t i = 0; i < n; i++) {
+        const float re = alpha_re*x_re[i] - alpha_im*x_im[i];
+        const float im = alpha_re*x_im[i] + alpha_im*x_re[i];
+        y_re[i] -= re;
+        y_im[i] -= im;
+    }
+}
+
+static void scalar_scale(float scale, float *x_re, float *x_im, size_t n)
+{
+    for (size_t i = 0; i < n; i++) {
+        x_re[i] *= scale;
+        x_im[i] *= scale;
+    }
+}
+
+static void scalar_power(const float *x_re, const float *x_im, size_t n, float &sum, float &max)
+{
+    float acc{};
+    float peak{};
+    for (size_t i = 0; i < n; i++) {
+        const float mag2 = x_re[i]*x_re[i] + x_im[i]*x_im[i];
+        acc += mag2;
+        peak = std::max(peak, mag2);
+    }
+    sum = acc;
+    max = peak;
+}
+
+static const ref_design_complex_kernels scalar_kernels{"scalar", scalar_dot_conj, scalar_sub_scaled, scalar_scale, scalar_power};
+
+#if defined(__x86_64__)
+////////////////////////////////////////////////////////////////////
+// AVX2 kernels
+////////////////////////////////////////////////////////////////////
+__attribute__((target("avx2,fma")))
+static float avx2_reduce(__m256 v)
+{
+    __m128 sum = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+    sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+    sum = _mm_add_ss(sum, _mm_movehdup_ps(sum));
+    return _mm_cvtss_f32(sum);
+}
+
+__attribute__((target("avx2,fma")))
+static float avx2_reduce_max(__m256 v)
+{
+    __m128 peak = _mm_max_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+    peak = _mm_max_ps(peak, _mm_movehl_ps(peak, peak));
+    peak = _mm_max_ss(peak, _mm_movehdup_ps(peak));
+    return _mm_cvtss_f32(peak);
+}
+
+__attribute__((target("avx2,fma")))
+static void avx2_dot_conj(const float *a_re, const float *a_im, const float *b_re, const float *b_im, size_t n, float &re, float &im)
+{
+    assert(n%8 == 0);
+    __m256 acc_re = _mm256_setzero_ps();
+    __m256 acc_im = _mm256_setzero_ps();
+    for (size_t i = 0; i < n; i += 8) {
+        const __m256 ar = _mm256_load_ps(a_re + i);
+        const __m256 ai = _mm256_load_ps(a_im + i);
+        const __m256 br = _mm256_load_ps(b_re + i);
+        const __m256 bi = _mm256_load_ps(b_im + i);
+        acc_re = _mm256_fmadd_ps(ar, br, acc_re);
+        acc_re = _mm256_fmadd_ps(ai, bi, acc_re);
+        acc_im = _mm256_fmadd_ps(ai, br, acc_im);
+        acc_im = _mm256_fnmadd_ps(ar, bi, acc_im);
+    }
+    re = avx2_reduce(acc_re);
+    im = avx2_reduce(acc_im);
+}
+
+__attribute__((target("avx2,fma")))
+static void avx2_sub_scaled(float alpha_re, float alpha_im, const float *x_re, const float *x_im, float *y_re, float *y_im, size_t n)
+{
+    assert(n%8 == 0);
+    const __m256 ar = _mm256_set1_ps(alpha_re);
+    const __m256 ai = _mm256_set1_ps(alpha_im);
+    for (size_t i = 0; i < n; i += 8) {
+        const __m256 xr = _mm256_load_ps(x_re + i);
+        const __m256 xi = _mm256_load_ps(x_im + i);
+        __m256 yr = _mm256_load_ps(y_re + i);
+        __m256 yi = _mm256_load_ps(y_im + i);
+        yr = _mm256_fnmadd_ps(ar, xr, yr);
+        yr = _mm256_fmadd_ps(ai, xi, yr);
+        yi = _mm256_fnmadd_ps(ar, xi, yi);
+        yi = _mm256_fnmadd_ps(ai, xr, yi);
+        _mm256_store_ps(y_re + i, yr);
+        _mm256_store_ps(y_im + i, yi);
+    }
+}
+
+__attribute__((target("avx2,fma")))
+static void avx2_scale(float scale, float *x_re, float *x_im, size_t n)
+{
+    assert(n%8 == 0);
+    const __m256 s = _mm256_set1_ps(scale);
+    for (size_t i = 0; i < n; i += 8) {
+        _mm256_store_ps(x_re + i, _mm256_mul_ps(s, _mm256_load_ps(x_re + i)));
+        _mm256_store_ps(x_im + i, _mm256_mul_ps(s, _mm256_load_ps(x_im + i)));
+    }
+}
+
+__attribute__((target("avx2,fma")))
+static void avx2_power(const float *x_re, const float *x_im, size_t n, float &sum, float &max)
+{
+    assert(n%8 == 0);
+    __m256 acc = _mm256_setzero_ps();
+    __m256 peak = _mm256_setzero_ps();
+    for (size_t i = 0; i < n; i += 8) {
+        const __m256 xr = _mm256_load_ps(x_re + i);
+        const __m256 xi = _mm256_load_ps(x_im + i);
+        const __m256 mag2 = _mm256_fmadd_ps(xi, xi, _mm256_mul_ps(xr, xr));
+        acc = _mm256_add_ps(acc, mag2);
+        peak = _mm256_max_ps(peak, mag2);
+    }
+    sum = avx2_reduce(acc);
+    max = avx2_reduce_max(peak);
+}
+
+static const ref_design_complex_kernels avx2_kernels{"avx2", avx2_dot_conj, avx2_sub_scaled, avx2_scale, avx2_power};
+
+////////////////////////////////////////////////////////////////////
+// AVX-512 kernels
+////////////////////////////////////////////////////////////////////
+// The _mm512_reduce_*_ps intrinsics are not warning clean with GCC 12, so the halves are reduced with AVX2 instead
+__attribute__((target("avx512f")))
+static float avx512_reduce(__m512 v)
+{
+    alignas(64) float lanes[16];
+    _mm512_store_ps(lanes, v);
+    return avx2_reduce(_mm256_add_ps(_mm256_load_ps(lanes), _mm256_load_ps(lanes + 8)));
+}
+
+__attribute__((target("avx512f")))
+static float avx512_reduce_max(__m512 v)
+{
+    alignas(64) float lanes[16];
+    _mm512_store_ps(lanes, v);
+    return avx2_reduce_max(_mm256_max_ps(_mm256_load_ps(lanes), _mm256_load_ps(lanes + 8)));
+}
+
+__attribute__((target("avx512f")))
+static void avx512_dot_conj(const float *a_re, const float *a_im, const float *b_re, const float *b_im, size_t n, float &re, float &im)
+{
+    assert(n%16 == 0);
+    __m512 acc_re = _mm512_setzero_ps();
+    __m512 acc_im = _mm512_setzero_ps();
+    for (size_t i = 0; i < n; i += 16) {
+        const __m512 ar = _mm512_load_ps(a_re + i);
+        const __m512 ai = _mm512_load_ps(a_im + i);
+        const __m512 br = _mm512_load_ps(b_re + i);
+        const __m512 bi = _mm512_load_ps(b_im + i);
+        acc_re = _mm512_fmadd_ps(ar, br, acc_re);
+        acc_re = _mm512_fmadd_ps(ai, bi, acc_re);
+        acc_im = _mm512_fmadd_ps(ai, br, acc_im);
+        acc_im = _mm512_fnmadd_ps(ar, bi, acc_im);
+    }
+    re = avx512_reduce(acc_re);
+    im = avx512_reduce(acc_im);
+}
+
+__attribute__((target("avx512f")))
+static void avx512_sub_scaled(float alpha_re, float alpha_im, const float *x_re, const float *x_im, float *y_re, float *y_im, size_t n)
+{
+    assert(n%16 == 0);
+    const __m512 ar = _mm512_set1_ps(alpha_re);
+    const __m512 ai = _mm512_set1_ps(alpha_im);
+    for (size_t i = 0; i < n; i += 16) {
+        const __m512 xr = _mm512_load_ps(x_re + i);
+        const __m512 xi = _mm512_load_ps(x_im + i);
+        __m512 yr = _mm512_load_ps(y_re + i);
+        __m512 yi = _mm512_load_ps(y_im + i);
+        yr = _mm512_fnmadd_ps(ar, xr, yr);
+        yr = _mm512_fmadd_ps(ai, xi, yr);
+        yi = _mm512_fnmadd_ps(ar, xi, yi);
+        yi = _mm512_fnmadd_ps(ai, xr, yi);
+        _mm512_store_ps(y_re + i, yr);
+        _mm512_store_ps(y_im + i, yi);
+    }
+}
+
+__attribute__((target("avx512f")))
+static void avx512_scale(float scale, float *x_re, float *x_im, size_t n)
+{
+    assert(n%16 == 0);
+    const __m512 s = _mm512_set1_ps(scale);
+    for (size_t i = 0; i < n; i += 16) {
+        _mm512_store_ps(x_re + i, _mm512_mul_ps(s, _mm512_load_ps(x_re + i)));
+        _mm512_store_ps(x_im + i, _mm512_mul_ps(s, _mm512_load_ps(x_im + i)));
+    }
+}
+
+__attribute__((target("avx512f")))
+static void avx512_power(const float *x_re, const float *x_im, size_t n, float &sum, float &max)
+{
+    assert(n%16 == 0);
+    __m512 acc = _mm512_setzero_ps();
+    __m512 peak = _mm512_setzero_ps();
+    for (size_t i = 0; i < n; i += 16) {
+        const __m512 xr = _mm512_load_ps(x_re + i);
+        const __m512 xi = _mm512_load_ps(x_im + i);
+        const __m512 mag2 = _mm512_fmadd_ps(xi, xi, _mm512_mul_ps(xr, xr));
+        acc = _mm512_add_ps(acc, mag2);
+        // The masked form, _mm512_max_ps passes an undefined source that GCC 12 warns about
+        peak = _mm512_mask_max_ps(peak, 0xffff, peak, mag2);
+    }
+    sum = avx512_reduce(acc);
+    max = avx512_reduce_max(peak);
+}
+
+static const ref_design_complex_kernels avx512_kernels{"avx512", avx512_dot_conj, avx512_sub_scaled, avx512_scale, avx512_power};
+#endif
+
+const ref_design_complex_kernels &ref_design_complex_kernels::scalar()
+{
+    return scalar_kernels;
+}
+
+const ref_design_complex_kernels &ref_design_complex_kernels::best()
+{
+    static const ref_design_complex_kernels &kernels = [] () -> const ref_design_complex_kernels & {
+#if defined(__x86_64__)
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx512f"))
+            return avx512_kernels;
+        if (__builtin_cpu_supports("avx2") and __builtin_cpu_supports("fma"))
+            return avx2_kernels;
+#endif
+        return scalar_kernels;
+    }();
+    return kernels;
+}
+
+const ref_design_complex_kernels *ref_design_complex_kernels::find(const std::string &name)
+{
+    if (name == "auto")
+        return &best();
+    if (name == scalar_kernels.name)
+        return &scalar_kernels;
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+    if (name == avx2_kernels.name and __builtin_cpu_supports("avx2") and __builtin_cpu_supports("fma"))
+        return &avx2_kernels;
+    if (name == avx512_kernels.name and __builtin_cpu_supports("avx512f"))
+        return &avx512_kernels;
+#endif
+    return nullptr;
+}
+
+////////////////////////////////////////////////////////////////////
+// Batched zero-forcing
+////////////////////////////////////////////////////////////////////
+void ref_design_zf_batch::aligned_free::operator()(float *ptr) const
+{
+    std::free(ptr);
+}
+
+void ref_design_zf_batch::resize(size_t num_problems, size_t max_users, size_t num_radios)
+{
+    const size_t stride = (num_radios + ref_design_kernel_width - 1)/ref_design_kernel_width*ref_design_kernel_width;
+    const size_t size = num_problems*4*max_users*stride;
+    if (size > _capacity) {
+        auto *ptr = static_cast<float *>(std::aligned_alloc(64, size*sizeof(float)));
+        if (ptr == nullptr)
+            throw std::bad_alloc();
+        _buffer.reset(ptr);
+        _capacity = size;
+        _zeroed_size = 0;
+    }
+
+    // Only the first num_radios of each row are written, so the padding is zeroed whenever the layout changes
+    if (max_users != _max_users or stride != _stride or num_radios != _num_radios)
+        _zeroed_size = 0;
+    if (size > _zeroed_size) {
+        std::memset(_buffer.get() + _zeroed_size, 0, (size - _zeroed_size)*sizeof(float));
+        _zeroed_size = size;
+    }
+
+    _num_problems = num_problems;
+    _max_users = max_users;
+    _num_radios = num_radios;
+    _stride = stride;
+    _num_users.assign(num_problems, 0);
+    _ok.assign(num_problems, false);
+    _regularization.assign(num_problems, 0.0);
+    _factors.resize(num_problems*max_users*max_users);
+}
+
+void ref_design_zf_batch::set_num_users(size_t problem, size_t num_users)
+{
+    assert(problem < _num_problems);
+    assert(num_users <= _max_users);
+    _num_users[problem] = num_users;
+}
+
+float *ref_design_zf_batch::_row(size_t problem, size_t user, size_t plane) const
+{
+    assert(problem < _num_problems);
+    assert(user < _max_users);
+    return _buffer.get() + ((problem*4 + plane)*_max_users + user)*_stride;
+}
+
+void ref_design_zf_batch::solve(size_t first_problem, size_t num_problems, float regularization, const ref_design_complex_kernels &kernels)
+{
+    assert(first_problem + num_problems <= _num_problems);
+    for (size_t problem = first_problem; problem < first_problem + num_problems; problem++) {
+        _ok[problem] = _factor(problem, regularization, kernels);
+        if (_ok[problem])
+            _substitute(problem, kernels);
+    }
+}
+
+void ref_design_zf_batch::solve_factored(size_t problem, const ref_design_complex_kernels &kernels)
+{
+    assert(problem < _num_problems);
+    _ok[problem] = _num_users[problem] != 0;
+    if (_ok[problem])
+        _substitute(problem, kernels);
+}
+
+bool ref_design_zf_batch::_factor(size_t problem, float regularization, const ref_design_complex_kernels &kernels)
+{
+    const size_t num_users = _num_users[problem];
+    if (num_users == 0)
+        return false;
+    std::complex<double> *L = factor(problem);
+
+    // Gram matrix G = A A^H, lower triangle only
+    double trace{};
+    for (size_t i = 0; i < num_users; i++) {
+        for (size_t j = 0; j <= i; j++) {
+            float re{};
+            float im{};
+            kernels.dot_conj(a_re(problem, i), a_im(problem, i), a_re(problem, j), a_im(problem, j), _stride, re, im);
+            L[i*_max_users + j] = {re, im};
+        }
+        trace += L[i*_max_users + i].real();
+    }
+    const double mean_power = trace/num_users;
+    if (not (mean_power > 0.0))
+        return false;
+    _regularization[problem] = regularization*mean_power;
+    for (size_t i = 0; i < num_users; i++)
+        L[i*_max_users + i] += _regularization[problem];
+
+    // In place Cholesky factorization G = L L^H
+    for (size_t i = 0; i < num_users; i++) {
+        for (size_t j = 0; j <= i; j++) {
+            std::complex<double> sum = L[i*_max_users + j];
+            for (size_t k = 0; k < j; k++)
+                sum -= L[i*_max_users + k]*std::conj(L[j*_max_users + k]);
+            if (i == j) {
+                if (not (sum.real() > ref_design_min_pivot*mean_power))
+                    return false;
+                L[i*_max_users + i] = std::sqrt(sum.real());
+            } else {
+                L[i*_max_users + j] = sum/L[j*_max_users + j].real();
+            }
+        }
+    }
+    return true;
+}
+
+void ref_design_zf_batch::_substitute(size_t problem, const ref_design_complex_kernels &kernels)
+{
+    const size_t num_users = _num_users[problem];
+    const std::complex<double> *L = factor(problem);
+
+    // Forward solve L Y = A, with Y stored in X
+    for (size_t i = 0; i < num_users; i++) {
+        float *y_re = _row(problem, i, 2);
+        float *y_im = _row(problem, i, 3);
+        std::memcpy(y_re, a_re(problem, i), _stride*sizeof(float));
+        std::memcpy(y_im, a_im(problem, i), _stride*sizeof(float));
+        for (size_t k = 0; k < i; k++) {
+            const auto l = L[i*_max_users + k];
+            kernels.sub_scaled(l.real(), l.imag(), x_re(problem, k), x_im(problem, k), y_re, y_im, _stride);
+        }
+        kernels.scale(1.0/L[i*_max_users + i].real(), y_re, y_im, _stride);
+    }
+
+    // Backward solve L^H X = Y
+    for (size_t i = num_users; i-- > 0;) {
+        float *out_re = _row(problem, i, 2);
+        float *out_im = _row(problem, i, 3);
+        for (size_t k = i + 1; k < num_users; k++) {
+            const auto l = std::conj(L[k*_max_users + i]);
+            kernels.sub_scaled(l.real(), l.imag(), x_re(problem, k), x_im(problem, k), out_re, out_im, _stride);
+        }
+        kernels.scale(1.0/L[i*_max_users + i].real(), out_re, out_im, _stride);
+    }
+}
@@ -0,0 +1,128 @@
+#pragma once
+
+#include "api.hpp"
+
+#include <complex>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+//! Smallest Cholesky pivot accepted, relative to the mean diagonal of the Gram matrix
+static constexpr double ref_design_min_pivot{1e-6};
+
+//! Vectors passed to the SIMD kernels must be 64 byte aligned and padded to a multiple of this many floats
+static constexpr size_t ref_design_kernel_width{16};
+
+/**
+ * Complex vector kernels operating on split real and imaginary planes.
+ *
+ * The scalar kernels are the reference implementation.  The AVX2 and AVX-512 kernels are selected at runtime
+ * when the CPU supports them.
+ */
+struct SKLK_PHY_MOD_REFDESIGN_API ref_design_complex_kernels
+{
+    const char *name;
+
+    //! (re, im) = sum(a*conj(b))
+    void (*dot_conj)(const float *a_re, const float *a_im, const float *b_re, const float *b_im, size_t n, float &re, float &im);
+
+    //! y -= alpha*x
+    void (*sub_scaled)(float alpha_re, float alpha_im, const float *x_re, const float *x_im, float *y_re, float *y_im, size_t n);
+
+    //! x *= scale
+    void (*scale)(float scale, float *x_re, float *x_im, size_t n);
+
+    //! sum = sum(|x|^2), max = max(|x|^2)
+    void (*power)(const float *x_re, const float *x_im, size_t n, float &sum, float &max);
+
+    [[nodiscard]] static const ref_design_complex_kernels &scalar();
+
+    //! The fastest kernels supported by this CPU
+    [[nodiscard]] static const ref_design_complex_kernels &best();
+
+    //! Look up kernels by name ("auto", "scalar", "avx2", "avx512"), nullptr if unknown or unsupported by this CPU
+    [[nodiscard]] static const ref_design_complex_kernels *find(const std::string &name);
+};
+
+/**
+ * A batch of zero-forcing problems solved in one pass.
+ *
+ * Each problem has a users x radios channel matrix A and is solved for X = (A A^H + lambda I)^-1 A using the
+ * Gram matrix, a Cholesky factorization, and forward and backward triangular solves.  The weights are B = X^H.
+ * Matrices are stored as rows of radios in split real and imaginary planes, padded for the SIMD kernels.
+ */
+class SKLK_PHY_MOD_REFDESIGN_API ref_design_zf_batch
+{
+    struct aligned_free
+    {
+        void operator()(float *ptr) const;
+    };
+
+    size_t _num_problems{0};
+    size_t _max_users{0};
+    size_t _num_radios{0};
+    size_t _stride{0};
+    size_t _capacity{0};
+    size_t _zeroed_size{0};
+    std::unique_ptr<float[], aligned_free> _buffer{};
+    std::vector<size_t> _num_users{};
+    std::vector<uint8_t> _ok{};
+    //! Absolute lambda added to the diagonal of each Gram matrix
+    std::vector<double> _regularization{};
+    //! Lower triangular Cholesky factor of each problem, max_users x max_users
+    std::vector<std::complex<double>> _factors{};
+
+public:
+    /**
+     * Size the batch, only allocating when the batch is larger than any previous batch.
+     * All problems are reset to zero users.
+     */
+    void resize(size_t num_problems, size_t max_users, size_t num_radios);
+
+    [[nodiscard]] size_t num_problems() const { return _num_problems; }
+    [[nodiscard]] size_t num_radios() const { return _num_radios; }
+    //! Padded length of each row, the length passed to the kernels
+    [[nodiscard]] size_t stride() const { return _stride; }
+
+    void set_num_users(size_t problem, size_t num_users);
+    [[nodiscard]] size_t num_users(size_t problem) const { return _num_users[problem]; }
+
+    //! Row of A for the user.  Only the first num_radios floats may be written, the padding must stay zero.
+    [[nodiscard]] float *a_re(size_t problem, size_t user) { return _row(problem, user, 0); }
+    [[nodiscard]] float *a_im(size_t problem, size_t user) { return _row(problem, user, 1); }
+
+    //! Row of X for the user, valid after solve() when ok(problem)
+    [[nodiscard]] const float *x_re(size_t problem, size_t user) const { return _row(problem, user, 2); }
+    [[nodiscard]] const float *x_im(size_t problem, size_t user) const { return _row(problem, user, 3); }
+
+    //! False when the Gram matrix of the problem was not positive definite
+    [[nodiscard]] bool ok(size_t problem) const { return _ok[problem]; }
+
+    //! Lower triangular factor L of A A^H + lambda I = L L^H, rows of factor_stride() entries
+    [[nodiscard]] std::complex<double> *factor(size_t problem) { return _factors.data() + problem*_max_users*_max_users; }
+    [[nodiscard]] const std::complex<double> *factor(size_t problem) const { return _factors.data() + problem*_max_users*_max_users; }
+    [[nodiscard]] size_t factor_stride() const { return _max_users; }
+
+    //! Absolute lambda added to the diagonal of the Gram matrix by the last solve()
+    [[nodiscard]] double regularization(size_t problem) const { return _regularization[problem]; }
+
+    /**
+     * Solve problems [first_problem, first_problem + num_problems).
+     * Disjoint ranges may be solved concurrently.
+     * @param regularization lambda relative to the mean diagonal of the Gram matrix, zero for zero-forcing
+     */
+    void solve(size_t first_problem, size_t num_problems, float regularization,
+               const ref_design_complex_kernels &kernels = ref_design_complex_kernels::best());
+
+    /**
+     * Solve a problem whose factor() has already been filled in, skipping the Gram matrix and the factorization.
+     */
+    void solve_factored(size_t problem, const ref_design_complex_kernels &kernels = ref_design_complex_kernels::best());
+
+private:
+    [[nodiscard]] float *_row(size_t problem, size_t user, size_t plane) const;
+    bool _factor(size_t problem, float regularization, const ref_design_complex_kernels &kernels);
+    void _substitute(size_t problem, const ref_design_complex_kernels &kernels);
+};
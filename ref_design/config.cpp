@@ -0,0 +1,112 @@
+#include "config.hpp"
+
+#include <sklk-mii/simple_log.hpp>
+
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <stdexcept>
+
+const char *ref_design_config_env_var{"SKLK_PHY_MOD_CONFIG"};
+
+ref_design_config ref_design_config::from_environment()
+{
+    ref_design_config config{};
+    const char *path = std::getenv(ref_design_config_env_var);
+    if (path == nullptr)
+        return config;
+
+    std::ifstream file(path);
+    if (not file) {
+        sklk_mii_log::error("Could not open mod config {}, using defaults", path);
+        return config;
+    }
+
+    try {
+        from_json(nlohmann::json::parse(file), config);
+    } catch (const std::exception &ex) {
+        sklk_mii_log::error("Could not parse mod config {}: {}, using defaults", path, ex.what());
+        return ref_design_config{};
+    }
+    sklk_mii_log::info("Loaded mod config {}", path);
+    return config;
+}
+
+void from_json(const nlohmann::json &j, ref_design_config &config)
+{
+    config.csi_worker_threads = j.value("csi_worker_threads", config.csi_worker_threads);
+    config.csi_worker_cpus = j.value("csi_worker_cpus", config.csi_worker_cpus);
+    config.csi_shards = j.value("csi_shards", config.csi_shards);
+    if (config.csi_shards == 0)
+        throw std::invalid_argument("csi_shards must be at least 1");
+    config.csi_thread = j.value("csi_thread", config.csi_thread);
+    if (config.csi_shards > 1 and not config.csi_thread.cpus.empty()) {
+        auto cpus = config.csi_thread.cpus;
+        std::sort(cpus.begin(), cpus.end());
+        if (cpus.size() != config.csi_shards + 1 or std::adjacent_find(cpus.begin(), cpus.end()) != cpus.end())
+            throw std::invalid_argument("csi_thread cpus must list a different CPU for each CSI shard and the router");
+    }
+    config.schedule_thread = j.value("schedule_thread", config.schedule_thread);
+    config.max_csi_ue_radios = j.value("max_csi_ue_radios", config.max_csi_ue_radios);
+    config.max_csi_age_frames = j.value("max_csi_age_frames", config.max_csi_age_frames);
+    config.csi_change_threshold = j.value("csi_change_threshold", config.csi_change_threshold);
+    config.csi_compute_budget_us = j.value("csi_compute_budget_us", config.csi_compute_budget_us);
+    config.csi_busy_poll_us = j.value("csi_busy_poll_us", config.csi_busy_poll_us);
+    config.max_weight_page_delay_frames = j.value("max_weight_page_delay_frames", config.max_weight_page_delay_frames);
+    config.weight_pages_per_group = j.value("weight_pages_per_group", config.weight_pages_per_group);
+    config.weight_cache_bytes = j.value("weight_cache_bytes", config.weight_cache_bytes);
+
+    const auto selection = j.value("group_selection", to_string(config.group_selection));
+    if (not from_string(selection, config.group_selection))
+        throw std::invalid_argument("unknown group_selection " + selection);
+    config.group_max_correlation = j.value("group_max_correlation", config.group_max_correlation);
+    config.group_selection_snr_db = j.value("group_selection_snr_db", config.group_selection_snr_db);
+    config.groups_per_block = j.value("groups_per_block", config.groups_per_block);
+    if (config.groups_per_block == 0 or config.groups_per_block > ref_design_max_groups_per_block)
+        throw std::invalid_argument("groups_per_block must be 1 to " + std::to_string(ref_design_max_groups_per_block));
+    config.group_rotation = j.value("group_rotation", config.group_rotation);
+    if (config.group_rotation != "round_robin" and config.group_rotation != "weighted" and
+        config.group_rotation != "proportional_fair")
+        throw std::invalid_argument("unknown group_rotation " + config.group_rotation);
+    config.pf_alpha = j.value("pf_alpha", config.pf_alpha);
+    if (not (config.pf_alpha >= 0.0f and config.pf_alpha < 1.0f))
+        throw std::invalid_argument("pf_alpha must be at least 0 and less than 1");
+
+    const auto solver = j.value("weight_solver", to_string(config.weight_solver));
+    if (not from_string(solver, config.weight_solver))
+        throw std::invalid_argument("unknown weight_solver " + solver);
+    config.rzf_regularization = j.value("rzf_regularization", config.rzf_regularization);
+    config.zf_kernels = j.value("zf_kernels", config.zf_kernels);
+    config.incremental_factorization = j.value("incremental_factorization", config.incremental_factorization);
+    config.incremental_drift_threshold = j.value("incremental_drift_threshold", config.incremental_drift_threshold);
+}
+
+void to_json(nlohmann::json &j, const ref_design_config &config)
+{
+    j = nlohmann::json{
+        {"csi_worker_threads", config.csi_worker_threads},
+        {"csi_worker_cpus", config.csi_worker_cpus},
+        {"csi_shards", config.csi_shards},
+        {"csi_thread", config.csi_thread},
+        {"schedule_thread", config.schedule_thread},
+        {"max_csi_ue_radios", config.max_csi_ue_radios},
+        {"max_csi_age_frames", config.max_csi_age_frames},
+        {"csi_change_threshold", config.csi_change_threshold},
+        {"csi_compute_budget_us", config.csi_compute_budget_us},
+        {"csi_busy_poll_us", config.csi_busy_poll_us},
+        {"max_weight_page_delay_frames", config.max_weight_page_delay_frames},
+        {"weight_pages_per_group", config.weight_pages_per_group},
+        {"weight_cache_bytes", config.weight_cache_bytes},
+        {"group_selection", to_string(config.group_selection)},
+        {"group_max_correlation", config.group_max_correlation},
+        {"group_selection_snr_db", config.group_selection_snr_db},
+        {"groups_per_block", config.groups_per_block},
+        {"group_rotation", config.group_rotation},
+        {"pf_alpha", config.pf_alpha},
+        {"weight_solver", to_string(config.weight_solver)},
+        {"rzf_regularization", config.rzf_regularization},
+        {"zf_kernels", config.zf_kernels},
+        {"incremental_factorization", config.incremental_factorization},
+        {"incremental_drift_threshold", config.incremental_drift_threshold},
+    };
+}
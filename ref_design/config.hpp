@@ -0,0 +1,107 @@
+#pragma once
+
+#include "api.hpp"
+#include "group_selection.hpp"
+#include "thread_policy.hpp"
+#include "weight_solver.hpp"
+
+#include <nlohmann/json.hpp>
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+//! Largest number of groups calculated for each resource block and direction
+static constexpr size_t ref_design_max_groups_per_block{8};
+
+//! Environment variable holding the path to a JSON file with the reference design configuration
+extern const char *ref_design_config_env_var;
+
+/**
+ * Tunables for the reference design modules.
+ *
+ * The defaults reproduce the behavior of the reference design.  Values are read from the JSON file named
+ * by the SKLK_PHY_MOD_CONFIG environment variable when the loader is created.  Missing keys keep their default.
+ */
+struct SKLK_PHY_MOD_REFDESIGN_API ref_design_config
+{
+    //! Number of worker threads calculating weight pages.  Zero calculates on the CSI module thread.
+    size_t csi_worker_threads{0};
+    /**
+     * CPUs the weight workers are pinned to, assigned round-robin over the workers of all CSI shards in shard order.
+     * Empty leaves the workers unpinned.
+     */
+    std::vector<int> csi_worker_cpus{};
+    //! CSI modules sharing the resource blocks, each on its own thread with csi_worker_threads workers
+    size_t csi_shards{1};
+    /**
+     * Placement of the CSI module threads.  With several shards, cpus lists one CPU for each shard followed by one
+     * for the CSI router, and each of these threads is pinned to its own CPU.
+     */
+    ref_design_thread_policy csi_thread{};
+    //! Placement of the schedule module thread
+    ref_design_thread_policy schedule_thread{};
+
+    /**
+     * Number of UE radios the CSI store has room for up front.  More UE radios still get CSI, but the CSI module
+     * grows the store when they join, which allocates on its thread.  Also the capacity of the proportional-fair
+     * tables, streams beyond it are scheduled without a proportional-fair entry.
+     */
+    size_t max_csi_ue_radios{64};
+    //! Frames after which CSI is too old to group a UE radio, counted up to the latest CSI or schedule request.  0 to
+    //! never expire CSI.
+    size_t max_csi_age_frames{0};
+    /**
+     * Relative error norm between new CSI and the CSI of the last material change below which the pages of the block
+     * are kept, 0 to recalculate the pages on every CSI
+     */
+    float csi_change_threshold{0.0f};
+    //! Time the CSI module may spend calculating pages per pass, the stalest pages go first, 0 for no limit
+    size_t csi_compute_budget_us{0};
+    //! Time the CSI module keeps polling for messages after calculating pages before it sleeps, 0 to sleep at once
+    size_t csi_busy_poll_us{0};
+    //! Frames behind the latest schedule request after which a page counts as late when it is scheduled, 0 to not count
+    size_t max_weight_page_delay_frames{0};
+    /**
+     * Weight pages kept for each group and reused while the user set of the group is unchanged.  A page is only
+     * reused once the schedule module and the PHY released it, 0 to request a new page for every calculation.
+     */
+    size_t weight_pages_per_group{4};
+    //! Memory for the weights of recent groups, split between the CSI shards, 0 to calculate every group again
+    size_t weight_cache_bytes{0};
+
+    //! Method used to choose the users of a group, see ref_design_group_selection for the names
+    ref_design_group_selection group_selection{ref_design_group_selection::random};
+    //! Largest correlation between the channels of two users grouped by sus
+    float group_max_correlation{0.5f};
+    //! SNR in dB at the mean channel power, used by greedy group selection to estimate the sum rate
+    float group_selection_snr_db{20.0f};
+    //! Disjoint groups calculated for each resource block and direction, up to ref_design_max_groups_per_block
+    size_t groups_per_block{1};
+    /**
+     * How the schedule module picks one of the groups of a block: rotate by frame with "round_robin", or "weighted"
+     * by group size, or pick the largest metric with "proportional_fair"
+     */
+    std::string group_rotation{"round_robin"};
+    //! Weight of the latest schedule request in the averaged rate of each stream
+    float pf_alpha{0.01f};
+
+    //! Method used to calculate the weights from the CSI, see ref_design_weight_solver for the names
+    ref_design_weight_solver weight_solver{ref_design_weight_solver::pinv_std};
+    //! Lambda of the rzf solver, relative to the mean diagonal of the Gram matrix
+    float rzf_regularization{0.01f};
+    /**
+     * Kernels used by the zf_cholesky and rzf solvers: "auto", "scalar", "avx2", or "avx512" solve every estimate
+     * of every page in one batch, "armadillo" solves each estimate separately with armadillo.
+     */
+    std::string zf_kernels{"auto"};
+    //! Update the factors of the batched solver with rank-one changes when users join or leave a group
+    bool incremental_factorization{true};
+    //! Largest relative error of diag(L L^H) accepted after an incremental update before refactoring
+    double incremental_drift_threshold{1e-3};
+
+    [[nodiscard]] static ref_design_config from_environment();
+};
+
+SKLK_PHY_MOD_REFDESIGN_API void from_json(const nlohmann::json &j, ref_design_config &config);
+SKLK_PHY_MOD_REFDESIGN_API void to_json(nlohmann::json &j, const ref_design_config &config);
@@ -1,4 +1,5 @@
 #include "csi_mod.hpp"
+#include "arma.hpp"
 #include "loader.hpp"
 #include "utils.hpp"
 
@@ -8,62 +9,163 @@
 
 #include <sklk-dsp/utils.hpp>
 
-#define ARMA_MAT_PREALLOC (SKLK_PHY_MAX_RADIOS*SKLK_PHY_MAX_MIMO_USERS)
-#include <armadillo>
+#include <algorithm>
+#include <numeric>
+#include <tuple>
+#include <utility>
 
 #define TX_BF_SCALE_FLT (0.5f/1.05f)
 #define RX_BF_SCALE_FLT (0.5f)
 
 const std::string ref_design_csi_mod_name{"csi"};
 
+std::string ref_design_csi_mod_shard_name(size_t shard_no)
+{
+    return shard_no ? ref_design_csi_mod_name + "." + std::to_string(shard_no) : ref_design_csi_mod_name;
+}
+
 class sklk_phy_mod_loader_template;
 
-ref_design_csi_mod::ref_design_csi_mod(ref_design_mod_loader *loader, const mimo_rrh_scheduler_config &config) :
-    sklk_phy_modding(ref_design_csi_mod_name),
+ref_design_csi_mod::ref_design_csi_mod(
+    ref_design_mod_loader *loader, const mimo_rrh_scheduler_config &config, const ref_design_config &mod_config,
+    size_t shard_no, size_t num_shards) :
+    sklk_phy_modding(ref_design_csi_mod_shard_name(shard_no)),
+    // Each shard takes its own CPU of the list, the router the one after the last shard
+    _thread_policy(num_shards > 1 ? ref_design_pin_thread_policy(mod_config.csi_thread, shard_no) : mod_config.csi_thread),
     _loader(loader),
     _num_resouce_blks(config.num_bands),
+    _first_resource_blk(shard_no*_num_resouce_blks/num_shards),
+    _end_resource_blk((shard_no + 1)*_num_resouce_blks/num_shards),
     _max_spatial_streams(config.max_users_per_group),
     _num_estimations(config.num_pilot_estimates),
-    _randomizer{std::random_device{}()}
+    _groups_per_block(mod_config.groups_per_block),
+    _weight_solver(mod_config.weight_solver),
+    _rzf_regularization(mod_config.rzf_regularization),
+    _zf_kernels(_select_zf_kernels(mod_config)),
+    _zf_regularization(mod_config.weight_solver == ref_design_weight_solver::rzf ? mod_config.rzf_regularization : 0.0f),
+    _incremental_factorization(mod_config.incremental_factorization),
+    _incremental_drift_threshold(mod_config.incremental_drift_threshold),
+    _max_csi_age_frames(mod_config.max_csi_age_frames),
+    _compute_budget(mod_config.csi_compute_budget_us),
+    _busy_poll(mod_config.csi_busy_poll_us),
+    _randomizer{std::random_device{}()},
+    _csi_store(std::make_shared<ref_design_csi_store>(
+        _end_resource_blk - _first_resource_blk, _num_estimations, mod_config.max_csi_ue_radios, mod_config.csi_change_threshold)),
+    _group_selector(mod_config.group_selection, mod_config.group_max_correlation, mod_config.group_selection_snr_db),
+    _group_keys((_end_resource_blk - _first_resource_blk)*2*_groups_per_block),
+    _pending_pages(_group_keys.size()),
+    _pages_per_group(mod_config.weight_pages_per_group),
+    _page_pool(_group_keys.size()*_pages_per_group),
+    // The shards take consecutive CPUs of the list, so their workers do not share CPUs while the list is long enough
+    _worker_pool(mod_config.csi_worker_threads, mod_config.csi_worker_cpus, shard_no*mod_config.csi_worker_threads),
+    _weight_cache(mod_config.weight_cache_bytes/num_shards, _num_estimations)
 {
+    if (mod_config.weight_cache_bytes and _weight_cache.capacity() == 0)
+        sklk_mii_log::warn("weight_cache_bytes is too small for one group of {} bytes", ref_design_weight_cache::entry_bytes(_num_estimations));
+    if (_zf_kernels != nullptr and _incremental_factorization)
+        _incremental_factors.resize(_group_keys.size()*_num_estimations, ref_design_incremental_factor(SKLK_PHY_MAX_MIMO_USERS));
+    for (auto &expiry : _page_expiry)
+        expiry.fill(SIZE_MAX);
+}
+
+const ref_design_complex_kernels *ref_design_csi_mod::_select_zf_kernels(const ref_design_config &mod_config)
+{
+    // The batched kernels only implement the Cholesky solvers
+    if (mod_config.weight_solver != ref_design_weight_solver::zf_cholesky and
+        mod_config.weight_solver != ref_design_weight_solver::rzf)
+        return nullptr;
+    if (mod_config.zf_kernels == "armadillo")
+        return nullptr;
+
+    const auto *kernels = ref_design_complex_kernels::find(mod_config.zf_kernels);
+    if (kernels == nullptr) {
+        sklk_mii_log::warn("ZF kernels {} are not supported, using {}", mod_config.zf_kernels, ref_design_complex_kernels::best().name);
+        kernels = &ref_design_complex_kernels::best();
+    }
+    sklk_mii_log::info("Using {} ZF kernels", kernels->name);
+    return kernels;
 }
 
 bool ref_design_csi_mod::run_once()
 {
-    if (not _initialized) {
-        if (sklk_mii_set_thread_priority(0.6) < 0)
-        {
-            sklk_mii_log::warn("Could not set elevated thread priority");
-        }
-        _initialized = true;
+    if (not _initialized.load(std::memory_order_relaxed)) {
+        _thread_placement = ref_design_apply_thread_policy(get_name(), _thread_policy, 0.6);
+        // After the NUMA policy, so the CSI lands on the node of this thread
+        _csi_store->allocate_arenas();
+        _initialized.store(true, std::memory_order_release);
     }
+    // Routed shards only see their own CSI, the router publishes the frame time of all of it
+    _last_frame_time = std::max(_last_frame_time, _loader->last_csi_frame_time.load(std::memory_order_relaxed));
+
+    // Removed UE radios only show up as a smaller map, their pages are marked dirty when the handles are updated
+    if (not _ue_radio_handles_valid or _ue_radio_handles.size() != ue_radio_map.size())
+        _update_ue_radio_handles();
 
     sklk_phy_mod_enable_radio_msg_t enable_radio_msg{};
+    bool radios_changed{false};
+    bool received{false};
     while (_msg_queues.enable_radio.pop(enable_radio_msg))
     {
+        received = true;
         const auto &[frame_time, radio_ch, enable] = enable_radio_msg;
+        if (_radio_enabled[radio_ch] != enable)
+            radios_changed = true;
         _radio_enabled[radio_ch] = enable;
     }
+    if (radios_changed) {
+        _update_enabled_radios();
+        for (auto &versions : _inputs_versions) {
+            versions[false]++;
+            versions[true]++;
+        }
+        _mark_all_dirty();
+    }
 
     sklk_phy_mod_cc_msg_t cc_msg;
     while (_msg_queues.cc.pop(cc_msg))
     {
+        received = true;
         const auto &[frame_time, radio_ch, resource_block_no, est_no, value] = cc_msg;
-        _cc_values.at(resource_block_no).at(est_no).at(radio_ch) = value;
+        if (not _owns(resource_block_no))
+            continue;
+        _csi_store->set_calibration(_store_blk(resource_block_no), est_no, radio_ch, value);
+        // Calibration is only applied to the downlink weights
+        _inputs_versions.at(resource_block_no)[true]++;
+        _mark_dirty(resource_block_no, true);
     }
 
     //! [CSI module requesting CSI update]
-    sklk_phy_mod_csi_msg_t csi_msg;
-    while (_msg_queues.csi.pop(csi_msg))
+    // Drain the whole backlog before storing any of it, so that repeated CSI is only stored once
+    // Pop straight into the batch, so the CSI is only copied out of the queue
+    while (_msg_queues.csi.pop(_csi_batch.emplace_back()))
     {
-        const auto &[frame_time, key, ue_radio, resource_blk_no, est_no, vec] = csi_msg;
-        csi_update(frame_time, key, ue_radio, resource_blk_no, est_no, vec);
+        received = true;
+        _last_frame_time = std::get<0>(_csi_batch.back());
+        if (not _owns(std::get<3>(_csi_batch.back())))
+            _csi_batch.pop_back();
     }
+    _csi_batch.pop_back();
+    _apply_csi_batch();
     //! [CSI module requesting CSI update]
 
-    _calculate_weights();
+    // The UE callbacks only mark pages dirty, so without messages, dirty pages, or expired groups there is nothing
+    // to calculate
+    if (not received and not _work_pending and _min_page_expiry >= _current_frame_time()) {
+        _stats.idle_runs++;
+        return _busy_poll.count() and std::chrono::steady_clock::now() - _last_work_time < _busy_poll;
+    }
+
+    _work_pending = _calculate_weights();
+    _min_page_expiry = SIZE_MAX;
+    for (size_t resource_blk_no = _first_resource_blk; resource_blk_no < _end_resource_blk; resource_blk_no++) {
+        for (size_t expiry : _page_expiry[resource_blk_no])
+            _min_page_expiry = std::min(_min_page_expiry, expiry);
+    }
+    if (_busy_poll.count())
+        _last_work_time = std::chrono::steady_clock::now();
 
-    return false;
+    // Run again right away for the pages deferred by the compute budget, otherwise sleep until the next message
+    return _work_pending or _busy_poll.count() > 0;
 }
 
 void ref_design_csi_mod::ue_changed(size_t key, const sklk_phy_ue &ue [[maybe_unused]], bool is_new)
@@ -71,226 +173,801 @@ void ref_design_csi_mod::ue_changed(size_t key, const sklk_phy_ue &ue [[maybe_un
     sklk_mii_log::info("{}: UE update {} is_new={}", get_name(), key, is_new);
 }
 
-void ref_design_csi_mod::ue_radio_changed(size_t key, const sklk_phy_ue_radio &ue_radio [[maybe_unused]], bool is_new)
+void ref_design_csi_mod::ue_radio_changed(size_t key, const sklk_phy_ue_radio &ue_radio, bool is_new)
 {
     sklk_mii_log::info("{}: UE radio update {} is_new={}", get_name(), key, is_new);
+    _ue_radio_handles_valid = false;
+    if (auto ue_radio_container = _get_container(key, ue_radio))
+        ue_radio_container->ue_radio_key.store(key, std::memory_order_relaxed);
+    if (is_new) {
+        // A new UE radio can join the group of any page
+        _mark_all_dirty();
+        return;
+    }
 
+    // Only the pages grouping a changed UE radio have to be calculated again
+    _mark_ue_radio_pages_dirty(key);
 }
-void ref_design_csi_mod::ue_stream_changed(size_t key, const sklk_phy_ue_stream &ue_stream [[maybe_unused]], bool is_new)
+
+void ref_design_csi_mod::_mark_ue_radio_pages_dirty(size_t key)
+{
+    auto it = _ue_radio_pages.find(key);
+    if (it == _ue_radio_pages.end())
+        return;
+    for (size_t resource_blk_no = _first_resource_blk; resource_blk_no < _end_resource_blk; resource_blk_no++) {
+        for (bool is_downlink : {false, true}) {
+            if (it->second.test(resource_blk_no*2 + is_downlink))
+                _mark_dirty(resource_blk_no, is_downlink);
+        }
+    }
+}
+void ref_design_csi_mod::ue_stream_changed(size_t key, const sklk_phy_ue_stream &ue_stream, bool is_new)
 {
     sklk_mii_log::info("{}: UE stream update {} is_new={}", get_name(), key, is_new);
+    // Groups are keyed by UE radio, not by stream, so only the pages grouping the stream's UE radio are affected
+    const size_t ue_radio_key = _ue_radio_key(ue_stream);
+    if (is_new or ue_radio_key == ref_design_csi_radio_container::invalid_key) {
+        _mark_all_dirty();
+        return;
+    }
+    _mark_ue_radio_pages_dirty(ue_radio_key);
+}
+
+ref_design_csi_radio_container::ref_design_csi_radio_container(std::shared_ptr<ref_design_csi_store> store) :
+    _store(std::move(store)),
+    slot(_store->allocate())
+{
+    // The CSI module thread grows the store, so this thread never allocates the arenas
+    if (slot == ref_design_csi_store::invalid_slot)
+        sklk_mii_log::info("CSI store is full, the CSI module will grow it");
+}
+
+ref_design_csi_radio_container::~ref_design_csi_radio_container()
+{
+    _store->release(slot.load(std::memory_order_relaxed));
+}
+
+size_t ref_design_ue_radio_key(const sklk_phy_ue_stream &ue_stream)
+{
+    // The container of a stream is the container of its UE radio
+    auto ptr = sklk_phy_mod_ue_access::get_container(ref_design_csi_mod_name, ue_stream);
+    auto ue_radio_container = std::dynamic_pointer_cast<ref_design_csi_radio_container>(ptr);
+    if (not ue_radio_container)
+        return ref_design_csi_radio_container::invalid_key;
+    return ue_radio_container->ue_radio_key.load(std::memory_order_relaxed);
 }
 
 //! [CSI module creating a container]
 sklk_phy_mod_container_ptr_t ref_design_csi_mod::allocate_ue_radio()
 {
-    return std::make_shared<ref_design_csi_radio_container>();
+    return std::make_shared<ref_design_csi_radio_container>(_csi_store);
 }
 //! [CSI module creating a container]
 
 //! [CSI module receiving CSI update]
 void ref_design_csi_mod::csi_update(
-    size_t frame_time, size_t key[[maybe_unused]], const sklk_phy_ue_radio &ue_radio, size_t resource_blk_no, size_t est_idx, const sklk_phy_csi_vec &vec)
+    size_t frame_time, size_t key, const sklk_phy_ue_radio &ue_radio, size_t resource_blk_no, size_t est_idx, const sklk_phy_csi_vec &vec)
 {
-    auto ptr = sklk_phy_mod_ue_access::get_container(get_name(), ue_radio);
-    auto ue_radio_container = std::dynamic_pointer_cast<ref_design_csi_radio_container>(ptr);
-    if (not ue_radio_container)
-        return;
-    auto &csi = ue_radio_container->csi.at(resource_blk_no).at(est_idx);
-    csi.set_csi(frame_time, vec);
     _last_frame_time = frame_time;
+    if (_owns(resource_blk_no))
+        _set_csi(frame_time, key, ue_radio, resource_blk_no, est_idx, vec);
 }
 //! [CSI module receiving CSI update]
 
-void ref_design_csi_mod::_calculate_weights()
+void ref_design_csi_mod::_set_csi(
+    size_t frame_time, size_t key, const sklk_phy_ue_radio &ue_radio, size_t resource_blk_no, size_t est_idx, const sklk_phy_csi_vec &vec)
+{
+    const size_t slot = _get_slot(key, ue_radio);
+    if (slot == ref_design_csi_store::invalid_slot)
+        return;
+    // CSI close to the CSI of the current weights is stored, but keeps the pages of the block
+    if (_csi_store->set_csi(_store_blk(resource_blk_no), est_idx, slot, frame_time, vec))
+        _mark_dirty(resource_blk_no);
+    else
+        _unchanged_csi[resource_blk_no] = true;
+}
+
+void ref_design_csi_mod::_apply_csi_batch()
 {
-    for (size_t resource_blk_no = 0; resource_blk_no < _num_resouce_blks; resource_blk_no++) {
-        _calculate_weights(resource_blk_no, true);
-        _calculate_weights(resource_blk_no, false);
+    if (_csi_batch.empty())
+        return;
+
+    // Order by block and estimation so the store is written row by row, and put the newest CSI of each
+    // UE radio last in its run.  Messages with the same frame time keep the order they arrived in.
+    _csi_order.resize(_csi_batch.size());
+    std::iota(_csi_order.begin(), _csi_order.end(), 0);
+    auto sort_key = [this](uint32_t msg_no) {
+        const auto &msg = _csi_batch[msg_no];
+        return std::make_tuple(std::get<3>(msg), std::get<4>(msg), std::get<1>(msg), std::get<0>(msg), msg_no);
+    };
+    std::sort(_csi_order.begin(), _csi_order.end(), [&](uint32_t a, uint32_t b) { return sort_key(a) < sort_key(b); });
+
+    for (size_t i = 0; i < _csi_order.size(); i++) {
+        const auto &[frame_time, key, ue_radio, resource_blk_no, est_no, vec] = _csi_batch[_csi_order[i]];
+        if (i + 1 < _csi_order.size()) {
+            const auto &next = _csi_batch[_csi_order[i + 1]];
+            if (std::get<3>(next) == resource_blk_no and std::get<4>(next) == est_no and std::get<1>(next) == key) {
+                _stats.coalesced_csi++;
+                continue;
+            }
+        }
+        _set_csi(frame_time, key, ue_radio, resource_blk_no, est_no, vec);
     }
+    _csi_batch.clear();
+}
+
+bool ref_design_csi_mod::_calculate_weights()
+{
+    const size_t num_jobs = _select_weight_jobs();
+    const bool deferred = num_jobs < _jobs.size();
+    if (num_jobs == 0)
+        return deferred;
+    const auto start_time = std::chrono::steady_clock::now();
+
+    // Select the groups and get the pages on this thread
+    _num_pending_pages = 0;
+    for (size_t job_no = 0; job_no < num_jobs; job_no++) {
+        const auto &job = _jobs[job_no];
+        _dirty_pages[job.resource_blk_no][job.is_downlink] = false;
+        _page_frame_times[job.resource_blk_no][job.is_downlink] = _last_frame_time;
+        _calculate_weights(job.resource_blk_no, job.is_downlink);
+    }
+    _stats.recomputed_pages += _num_pending_pages;
+    if (_num_pending_pages == 0)
+        return deferred;
+
+    if (_zf_kernels != nullptr) {
+        _calculate_weight_pages_batched();
+    } else {
+        // Every estimate of every page is independent, so calculate them all on the worker pool
+        _worker_pool.run(_num_pending_pages*_num_estimations, [this](size_t job_no) {
+            auto &pending = _pending_pages[job_no/_num_estimations];
+            const size_t est_idx = job_no%_num_estimations;
+            if (pending.cached)
+                return;
+            if (not _calculate_weight_page_estimate(pending, est_idx))
+                pending.failed = true;
+        });
+    }
+
+    // All estimates have completed, hand the groups of each block to the schedule module together
+    size_t first_page{0};
+    for (size_t page_no = 0; page_no < _num_pending_pages; page_no++) {
+        auto &pending = _pending_pages[page_no];
+        _finish_weight_page(pending);
+        if (not pending.failed and not pending.cached)
+            _cache_weights(pending);
+        const auto &first = _pending_pages[first_page];
+        const bool last_of_block = page_no + 1 == _num_pending_pages or
+            _pending_pages[page_no + 1].resource_blk_no != first.resource_blk_no or
+            _pending_pages[page_no + 1].is_downlink != first.is_downlink;
+        if (last_of_block) {
+            _publish_weight_pages(first_page, page_no + 1 - first_page);
+            first_page = page_no + 1;
+        }
+    }
+
+    // The loader and the pool keep the pages, a reference left here would keep them from being reused
+    for (size_t page_no = 0; page_no < _num_pending_pages; page_no++)
+        _pending_pages[page_no].page_hdl.reset();
+
+    const std::chrono::duration<double, std::micro> elapsed = std::chrono::steady_clock::now() - start_time;
+    // A job calculates all the groups of its block, so the budget is spent per job
+    const double job_cost_us = elapsed.count()/num_jobs;
+    _job_cost_us = _job_cost_us == 0.0 ? job_cost_us : _job_cost_us + (job_cost_us - _job_cost_us)/8;
+    return deferred;
+}
+
+size_t ref_design_csi_mod::_select_weight_jobs()
+{
+    // Only recalculate pages when a CSI, CC, or radio enable message has changed the inputs,
+    // or when CSI of the last group has become too old to use
+    const size_t deadline = _current_frame_time();
+    _jobs.clear();
+    for (size_t resource_blk_no = _first_resource_blk; resource_blk_no < _end_resource_blk; resource_blk_no++) {
+        const bool unchanged_csi = std::exchange(_unchanged_csi[resource_blk_no], false);
+        for (bool is_downlink : {true, false}) {
+            auto &dirty = _dirty_pages[resource_blk_no][is_downlink];
+            if (_page_expiry[resource_blk_no][is_downlink] < deadline)
+                dirty = true;
+            if (not dirty) {
+                if (unchanged_csi)
+                    _stats.reused_pages++;
+                continue;
+            }
+            const size_t page_frame_time = _page_frame_times[resource_blk_no][is_downlink];
+            _jobs.push_back({deadline > page_frame_time ? deadline - page_frame_time : 0, resource_blk_no, is_downlink});
+        }
+    }
+    if (_compute_budget.count() == 0 or _job_cost_us == 0.0)
+        return _jobs.size();
+
+    // The pages that the next schedule request would see oldest go first, the rest stay dirty for a later pass
+    const size_t num_jobs = std::min(_jobs.size(), std::max<size_t>(1, size_t(_compute_budget.count()/_job_cost_us)));
+    std::stable_sort(_jobs.begin(), _jobs.end(), [](const auto &a, const auto &b) { return a.staleness > b.staleness; });
+    _stats.deferred_pages += _jobs.size() - num_jobs;
+    return num_jobs;
 }
 
 void ref_design_csi_mod::_calculate_weights(size_t resource_blk_no, bool is_downlink)
 {
-    std::vector<sklk_phy_ue_stream> all_ue_streams{};
-    all_ue_streams.reserve(ue_radio_map.size());
-    for (const auto &[_, ue_radio] : ue_radio_map) {
-        auto ptr = sklk_phy_mod_ue_access::get_container(get_name(), ue_radio);
-        auto ue_radio_container = std::dynamic_pointer_cast<ref_design_csi_radio_container>(ptr);
-        if (ue_radio_container and ue_radio_container->csi[resource_blk_no].ready())
-            all_ue_streams.emplace_back(ue_radio);
+    const size_t oldest_frame_time = _oldest_usable_frame_time();
+    _page_expiry[resource_blk_no][is_downlink] = SIZE_MAX;
+    _index_group_keys(resource_blk_no, is_downlink, false);
+    const bool had_groups = std::exchange(_indexed_groups[resource_blk_no][is_downlink], 0) > 0;
+
+    auto &all_ue_streams = _candidates;
+    all_ue_streams.clear();
+    for (const auto &handle : _ue_radio_handles) {
+        if (handle.slot == ref_design_csi_store::invalid_slot or not _csi_store->ready(_store_blk(resource_blk_no), handle.slot))
+            continue;
+        if (not _csi_store->ready(_store_blk(resource_blk_no), handle.slot, oldest_frame_time)) {
+            _stats.stale_drops++;
+            continue;
+        }
+        all_ue_streams.push_back({handle.key, handle.slot, &handle.ue_radio});
     }
-    if (all_ue_streams.empty())
+    if (all_ue_streams.empty()) {
+        // Withdraw the last groups, their CSI is stale or their UE radios are gone
+        if (had_groups)
+            _loader->send_weight_pages(_last_frame_time, resource_blk_no, is_downlink, {}, {});
         return;
+    }
 
-    std::vector<sklk_phy_ue_stream>  ue_streams_to_use{};
-    auto num_csi = std::max(all_ue_streams.size(), _max_spatial_streams);
-    if (num_csi == all_ue_streams.size()) {
-        std::swap(all_ue_streams, ue_streams_to_use);
-    } else {
-        std::sample(all_ue_streams.begin(), all_ue_streams.end(), std::back_inserter(ue_streams_to_use), num_csi, _randomizer);
+    // Each group is selected from the users left over by the groups before it
+    auto &ue_streams_to_use = _group;
+    for (size_t group_no = 0; group_no < _groups_per_block and not all_ue_streams.empty(); group_no++) {
+        ue_streams_to_use.clear();
+        _group_selector.reset(all_ue_streams.size(), _num_enabled_radios);
+        if (_group_selector.selection() != ref_design_group_selection::random) {
+            // Select on the channel of the middle estimation, over the enabled radios
+            const size_t est_idx = _num_estimations/2;
+            for (size_t candidate = 0; candidate < all_ue_streams.size(); candidate++) {
+                const sklk_mii_cf_t *user_csi = _csi_store->csi(_store_blk(resource_blk_no), est_idx, all_ue_streams[candidate].slot);
+                sklk_mii_cf_t *channel = _group_selector.channel(candidate);
+                for (size_t radio_idx = 0; radio_idx < _num_enabled_radios; radio_idx++)
+                    channel[radio_idx] = user_csi[_enabled_radios[radio_idx]];
+            }
+        }
+        _group_selector.select(_max_spatial_streams, _randomizer, _selected);
+        for (size_t candidate : _selected)
+            ue_streams_to_use.push_back(all_ue_streams[candidate]);
+        if (ue_streams_to_use.empty())
+            break;
+
+        if (_max_csi_age_frames) {
+            auto &expiry = _page_expiry[resource_blk_no][is_downlink];
+            for (const auto &candidate : ue_streams_to_use)
+                expiry = std::min(expiry, _csi_store->oldest_frame_time(_store_blk(resource_blk_no), candidate.slot) + _max_csi_age_frames);
+        }
+
+        _queue_weight_page(ue_streams_to_use, resource_blk_no, is_downlink, group_no);
+
+        std::sort(_selected.begin(), _selected.end());
+        for (auto it = _selected.rbegin(); it != _selected.rend(); ++it)
+            all_ue_streams.erase(all_ue_streams.begin() + *it);
+        _indexed_groups[resource_blk_no][is_downlink]++;
     }
+    _index_group_keys(resource_blk_no, is_downlink, true);
+}
+
+size_t ref_design_csi_mod::_current_frame_time() const
+{
+    return std::max(_loader->last_schedule_frame_time.load(std::memory_order_relaxed), _last_frame_time);
+}
 
-    _calculate_weight_page(ue_streams_to_use, resource_blk_no, is_downlink);
+size_t ref_design_csi_mod::_oldest_usable_frame_time() const
+{
+    const size_t frame_time = _current_frame_time();
+    if (not _max_csi_age_frames or frame_time < _max_csi_age_frames)
+        return 0;
+    return frame_time - _max_csi_age_frames;
 }
 
-void ref_design_csi_mod::_calculate_weight_page(
-    const std::vector<sklk_phy_ue_stream> &ue_streams, size_t resource_blk_no, bool is_downlink)
+void ref_design_csi_mod::_queue_weight_page(
+    const std::vector<ref_design_group_candidate> &group, size_t resource_blk_no, bool is_downlink, size_t group_no)
 {
-    auto page_hdl = _loader->get_weight_page(_last_frame_time, resource_blk_no, is_downlink, ue_streams).initialize().first;
+    assert(_num_pending_pages < _pending_pages.size());
+    auto &pending = _pending_pages[_num_pending_pages++];
+    pending.resource_blk_no = resource_blk_no;
+    pending.is_downlink = is_downlink;
+    pending.group_no = group_no;
+    pending.ue_keys.clear();
+    pending.ue_slots.clear();
+    pending.ue_streams.clear();
+
+    // Users remaining from the last group keep their order ahead of new users so the factors can be updated
+    auto &group_keys = _group_keys[_group_index(resource_blk_no, is_downlink, group_no)];
+    for (size_t key : group_keys) {
+        auto it = std::find_if(group.begin(), group.end(), [&](const auto &candidate) { return candidate.key == key; });
+        if (it == group.end())
+            continue;
+        pending.ue_keys.push_back(it->key);
+        pending.ue_slots.push_back(it->slot);
+        pending.ue_streams.push_back(*it->ue_stream);
+    }
+    for (const auto &candidate : group) {
+        if (std::find(pending.ue_keys.begin(), pending.ue_keys.end(), candidate.key) != pending.ue_keys.end())
+            continue;
+        pending.ue_keys.push_back(candidate.key);
+        pending.ue_slots.push_back(candidate.slot);
+        pending.ue_streams.push_back(*candidate.ue_stream);
+    }
+    group_keys = pending.ue_keys;
 
+    const size_t num_users = pending.ue_slots.size();
+    pending.csi_versions.resize(_num_estimations*num_users);
+    pending.material_versions.resize(_num_estimations*num_users);
     for (size_t est_idx = 0; est_idx < _num_estimations; est_idx++) {
-        if (not _calculate_weight_page_estimate(page_hdl, resource_blk_no, est_idx, is_downlink)) {
-            auto identifier = get_identifier(ue_streams);
-            sklk_mii_log::error("Weight calculation failed: streams: {}", identifier);
-            sklk_phy_mod_page_access::set_page_status(_last_frame_time, page_hdl, false);
-            return;
+        for (size_t userno = 0; userno < num_users; userno++) {
+            const size_t slot = pending.ue_slots[userno];
+            pending.csi_versions[est_idx*num_users + userno] = _csi_store->version(_store_blk(resource_blk_no), est_idx, slot);
+            pending.material_versions[est_idx*num_users + userno] = _csi_store->material_version(_store_blk(resource_blk_no), est_idx, slot);
         }
     }
+    pending.page_hdl = _get_weight_page(pending);
+    pending.failed = false;
+    pending.cached = _load_cached_weights(pending);
+}
 
-    sklk_phy_weight_page &page = *sklk_phy_mod_page_access::get_page_from_hdl(page_hdl);
-    if (is_downlink) {
-        _scale_pages_for_downlink(page, ue_streams.size(), SKLK_PHY_MAX_RADIOS, TX_BF_SCALE_FLT);
-    } else {
-        _scale_pages_for_uplink(page, ue_streams.size(), SKLK_PHY_MAX_RADIOS, RX_BF_SCALE_FLT);
+ref_design_weight_cache_key ref_design_csi_mod::_weight_cache_key(const ref_design_pending_weight_page &pending) const
+{
+    // The material versions cover the channel of each user, the inputs version the radios and calibration of the block
+    return {pending.resource_blk_no, pending.is_downlink, _inputs_versions[pending.resource_blk_no][pending.is_downlink],
+            pending.ue_keys.data(), pending.material_versions.data(), pending.ue_keys.size()};
+}
+
+bool ref_design_csi_mod::_load_cached_weights(ref_design_pending_weight_page &pending)
+{
+    if (_weight_cache.capacity() == 0)
+        return false;
+    const size_t entry = _weight_cache.find(_weight_cache_key(pending));
+    if (entry == ref_design_weight_cache::invalid_entry) {
+        _stats.weight_cache_misses++;
+        return false;
+    }
+    _stats.weight_cache_hits++;
+
+    sklk_phy_weight_page &page = _weight_page(pending.page_hdl);
+    for (size_t est_idx = 0; est_idx < _num_estimations; est_idx++) {
+        for (size_t userno = 0; userno < pending.ue_keys.size(); userno++) {
+            const sklk_mii_cf_t *weights = _weight_cache.weights(entry, pending.ue_keys[userno], est_idx);
+            for (size_t radio_ch = 0; radio_ch < SKLK_PHY_MAX_RADIOS; radio_ch++)
+                page.get_symbol(radio_ch, userno, est_idx) = weights[radio_ch];
+        }
     }
+    return true;
+}
+
+void ref_design_csi_mod::_cache_weights(const ref_design_pending_weight_page &pending)
+{
+    const size_t entry = _weight_cache.insert(_weight_cache_key(pending));
+    if (entry == ref_design_weight_cache::invalid_entry)
+        return;
 
-    sklk_phy_mod_page_access::set_page_status(_last_frame_time, page_hdl, true);
-    _loader->send_weight_page(resource_blk_no, is_downlink, page_hdl);
+    sklk_phy_weight_page &page = _weight_page(pending.page_hdl);
+    for (size_t est_idx = 0; est_idx < _num_estimations; est_idx++) {
+        for (size_t userno = 0; userno < pending.ue_keys.size(); userno++) {
+            sklk_mii_cf_t *weights = _weight_cache.weights(entry, pending.ue_keys[userno], est_idx);
+            for (size_t radio_ch = 0; radio_ch < SKLK_PHY_MAX_RADIOS; radio_ch++)
+                weights[radio_ch] = page.get_symbol(radio_ch, userno, est_idx);
+        }
+    }
 }
 
-bool ref_design_csi_mod::_calculate_weight_page_estimate(
-    const sklk_phy_weight_page_id_t &page_hdl, size_t resource_blk_no, size_t est_idx, bool is_downlink )
+sklk_phy_weight_page_id_t ref_design_csi_mod::_get_weight_page(const ref_design_pending_weight_page &pending)
 {
-    std::array<size_t, SKLK_PHY_MAX_RADIOS> _indexes{};
-    size_t num_radios{};
-    assert(num_radios == 0);
-    for(size_t radio_ch{0}; radio_ch < SKLK_PHY_MAX_RADIOS; radio_ch++) {
-        assert(num_radios < SKLK_PHY_MAX_RADIOS);
-        if (_radio_enabled[radio_ch])
-            _indexes[num_radios++] = radio_ch;
+    auto *pool = _page_pool.data() + _group_index(pending.resource_blk_no, pending.is_downlink, pending.group_no)*_pages_per_group;
+    ref_design_pooled_weight_page *free_page{nullptr};
+    for (size_t page_no = 0; page_no < _pages_per_group; page_no++) {
+        auto &pooled = pool[page_no];
+        // Only a page held by the pool alone is no longer read by the schedule module or the PHY
+        if (pooled.page_hdl and pooled.page_hdl.use_count() > 1)
+            continue;
+        if (pooled.page_hdl and pooled.ue_keys == pending.ue_keys and _page_is_valid(pooled.page_hdl)) {
+            // Pairs with the release of the last other reference, so its reads of the page happen before the writes
+            std::atomic_thread_fence(std::memory_order_acquire);
+            pooled.last_used = ++_page_pool_clock;
+            _stats.reused_weight_pages++;
+            return pooled.page_hdl;
+        }
+        if (free_page == nullptr or pooled.last_used < free_page->last_used)
+            free_page = &pooled;
     }
-    assert(num_radios <= SKLK_PHY_MAX_RADIOS);
 
+    // The users changed or every page of the pool is still in use
+    _stats.initialized_pages++;
+    auto page_hdl = _new_weight_page(pending);
+    if (free_page == nullptr) {
+        if (_pages_per_group)
+            _stats.unpooled_pages++;
+        return page_hdl;
+    }
+    free_page->page_hdl = page_hdl;
+    free_page->ue_keys = pending.ue_keys;
+    free_page->last_used = ++_page_pool_clock;
+    return page_hdl;
+}
+
+void ref_design_csi_mod::_finish_weight_page(ref_design_pending_weight_page &pending)
+{
+    const auto &page_hdl = pending.page_hdl;
+    if (pending.failed) {
+        auto identifier = get_identifier(pending.ue_streams);
+        sklk_mii_log::error("Weight calculation failed: streams: {}", identifier);
+        _set_page_status(page_hdl, false);
+        return;
+    }
+
+    _set_page_status(page_hdl, true);
+}
+
+void ref_design_csi_mod::_publish_weight_pages(size_t first_page, size_t num_pages)
+{
+    // Groups that failed or had no users left are not scheduled
+    ref_design_weight_page_set pages{};
+    ref_design_group_keys keys{};
+    bool any_ok{false};
+    for (size_t page_no = first_page; page_no < first_page + num_pages; page_no++) {
+        const auto &pending = _pending_pages[page_no];
+        if (pending.failed)
+            continue;
+        pages[pending.group_no] = pending.page_hdl;
+        std::copy(pending.ue_keys.begin(), pending.ue_keys.end(), keys.keys[pending.group_no].begin());
+        keys.num_keys[pending.group_no] = pending.ue_keys.size();
+        any_ok = true;
+    }
+    // Keep scheduling the previous pages when none could be calculated
+    if (not any_ok)
+        return;
+    const auto &first = _pending_pages[first_page];
+    _loader->send_weight_pages(
+        _page_frame_times[first.resource_blk_no][first.is_downlink], first.resource_blk_no, first.is_downlink, pages, keys);
+}
+
+bool ref_design_csi_mod::_calculate_weight_page_estimate(const ref_design_pending_weight_page &pending, size_t est_idx)
+{
+    const size_t num_radios = _num_enabled_radios;
     if (not num_radios) {
         return false;
     }
 
-    sklk_phy_weight_page &page = *sklk_phy_mod_page_access::get_page_from_hdl(page_hdl);
-    auto streams = sklk_phy_mod_page_access::get_ue_streams(page_hdl);
+    const size_t resource_blk_no = pending.resource_blk_no;
+    sklk_phy_weight_page &page = _weight_page(pending.page_hdl);
+    const auto &slots = pending.ue_slots;
 
-    arma::Mat<sklk_mii_cf_t> A(streams.size(), num_radios);
-    arma::Mat<sklk_mii_cf_t> B(num_radios, streams.size());
+    arma::Mat<sklk_mii_cf_t> A(slots.size(), num_radios);
+    arma::Mat<sklk_mii_cf_t> B(num_radios, slots.size());
     static_assert(arma::arma_config::mat_prealloc == ARMA_MAT_PREALLOC);
 
     //load the matrix with channel estimates for this particular subcarrier
-    for (size_t userno = 0; userno < streams.size(); userno++)
+    for (size_t userno = 0; userno < slots.size(); userno++)
     {
-        auto ue_radio = sklk_phy_mod_ue_access::get_container(get_name(), streams[userno]);
-        auto ue_radio_container = std::dynamic_pointer_cast<ref_design_csi_radio_container>(ue_radio);
-
         // NOTE: This works because there is currently a one-to-one mapping from radio to stream.
-        const sklk_phy_csi_vec zeros{};
-        const sklk_phy_csi_vec &user_csi_vec = ue_radio_container ? ue_radio_container->csi[resource_blk_no][est_idx].data() : zeros;
+        // The downlink uses the CSI with the calibration already applied
+        const size_t store_blk = _store_blk(resource_blk_no);
+        const sklk_mii_cf_t *user_csi = pending.is_downlink ?
+            _csi_store->calibrated_csi(store_blk, est_idx, slots[userno]) : _csi_store->csi(store_blk, est_idx, slots[userno]);
 
         for (size_t radio_idx = 0; radio_idx < num_radios; radio_idx++) {
-            size_t radio_ch = _indexes[radio_idx];
+            size_t radio_ch = _enabled_radios[radio_idx];
             assert(radio_ch < SKLK_PHY_MAX_RADIOS);
-            auto value = user_csi_vec[radio_ch];
-            if (is_downlink)
-                value *= _cc_values[resource_blk_no][est_idx][radio_ch];
-            A.row(userno)[radio_idx] = value;
+            A.row(userno)[radio_idx] = user_csi[radio_ch];
         }
     }
 
-    //compute the pseudo-inverse
-    //the divide-and-conquer method provides slightly different results than the standard method, but is considerably faster for large matrices
-    if (not arma::pinv(B, A, 0, "std"))
+    //compute the weights, by default with the pseudo-inverse
+    if (not ref_design_solve_weights(B, A, _weight_solver, _rzf_regularization))
     {
-        sklk_mii_log::error("pinv failed");
+        sklk_mii_log::error("{} failed", to_string(_weight_solver));
         return false;
     }
 
-    //copy pinv buffer into weight structure
-    for (size_t userno = 0; userno < streams.size(); userno++) {
-        // Clear the weights for disable radios
-        for(size_t radio_ch{0}; radio_ch < SKLK_PHY_MAX_RADIOS; radio_ch++) {
-            assert(num_radios < SKLK_PHY_MAX_RADIOS);
-            if (not _radio_enabled[radio_ch])
-                page.get_symbol(radio_ch, userno, est_idx) = sklk_mii_cf_t{};
-        }
-
-        // Set the weights enable radios
+    //copy pinv buffer into weight structure, normalized and scaled
+    std::array<float, SKLK_PHY_MAX_MIMO_USERS> power{};
+    std::array<float, SKLK_PHY_MAX_MIMO_USERS> max_power{};
+    std::array<float, SKLK_PHY_MAX_MIMO_USERS> scale{};
+    for (size_t userno = 0; userno < slots.size(); userno++) {
+        const sklk_mii_cf_t *weights = B.colptr(userno);
         for (size_t radio_idx = 0; radio_idx < num_radios; radio_idx++) {
-            size_t radio_ch = _indexes[radio_idx];
-            auto &wf = page.get_symbol(radio_ch, userno, est_idx);
-            wf = B.row(radio_idx)[userno];
+            const float mag2 = sklk_dsp_mag2(weights[radio_idx]);
+            power[userno] += mag2;
+            max_power[userno] = std::max(max_power[userno], mag2);
         }
     }
+    _scale_weights(pending.is_downlink, power.data(), max_power.data(), slots.size(), scale.data());
+    for (size_t userno = 0; userno < slots.size(); userno++) {
+        const sklk_mii_cf_t *weights = B.colptr(userno);
+        _write_weights(page, userno, est_idx, scale[userno], [&](size_t radio_idx) { return weights[radio_idx]; });
+    }
 
     return true;
 }
 
-void ref_design_csi_mod::_scale_pages_for_downlink(
-    sklk_phy_weight_page &page, size_t num_users, size_t num_radios, float amplitude_ceiling)
+void ref_design_csi_mod::_calculate_weight_pages_batched()
 {
-    for (size_t sbno = 0; sbno < NUM_PILOT_SUBBANDS; sbno++) {
-        // Normalize the weights for each user
-        for (size_t userno = 0; userno < num_users; userno++) {
-            float dnl_power{};
-            for (size_t ch = 0; ch < num_radios; ch++) {
-                const auto &d_w = page.get_symbol(ch, userno, sbno);
-                dnl_power += sklk_dsp_mag2(d_w);
-            }
-            const float scale = 1.0f/ std::sqrt(dnl_power);
-            for (size_t ch = 0; ch < num_radios; ch++) {
-                page.get_symbol(ch, userno, sbno) *= scale;
-            }
+    // Every estimate of every page is one problem of the batch
+    size_t max_users{0};
+    for (size_t page_no = 0; page_no < _num_pending_pages; page_no++)
+        max_users = std::max(max_users, _pending_pages[page_no].ue_streams.size());
+    _zf_batch.resize(_num_pending_pages*_num_estimations, max_users, _num_enabled_radios);
+
+    _worker_pool.run(_num_pending_pages, [this](size_t page_no) {
+        auto &pending = _pending_pages[page_no];
+        if (pending.cached)
+            return;
+        if (not _num_enabled_radios) {
+            pending.failed = true;
+            return;
         }
 
-        // Get max power across all users
-        float max_power{};
-        for (size_t ch = 0; ch < num_radios; ch++){
+        const size_t first_problem = page_no*_num_estimations;
+        for (size_t est_idx = 0; est_idx < _num_estimations; est_idx++)
+            _load_zf_problem(pending, est_idx, first_problem + est_idx);
+        for (size_t est_idx = 0; est_idx < _num_estimations; est_idx++)
+            _solve_zf_problem(pending, est_idx, first_problem + est_idx);
+
+        sklk_phy_weight_page &page = _weight_page(pending.page_hdl);
+        for (size_t est_idx = 0; est_idx < _num_estimations; est_idx++) {
+            const size_t problem = first_problem + est_idx;
+            if (not _zf_batch.ok(problem)) {
+                // The Gram matrix is not positive definite, fall back to the pseudo-inverse
+                if (not _calculate_weight_page_estimate(pending, est_idx))
+                    pending.failed = true;
+                continue;
+            }
+
+            // B = X^H, the padding of the rows is zero so the power can use the whole stride
+            const size_t num_users = pending.ue_streams.size();
+            std::array<float, SKLK_PHY_MAX_MIMO_USERS> power{};
+            std::array<float, SKLK_PHY_MAX_MIMO_USERS> max_power{};
+            std::array<float, SKLK_PHY_MAX_MIMO_USERS> scale{};
             for (size_t userno = 0; userno < num_users; userno++) {
-                const auto &w = page.get_symbol(ch, userno, sbno);
-                max_power = std::max(max_power, sklk_dsp_mag2(w));
+                _zf_kernels->power(_zf_batch.x_re(problem, userno), _zf_batch.x_im(problem, userno), _zf_batch.stride(),
+                                   power[userno], max_power[userno]);
+            }
+            _scale_weights(pending.is_downlink, power.data(), max_power.data(), num_users, scale.data());
+            for (size_t userno = 0; userno < num_users; userno++) {
+                const float *x_re = _zf_batch.x_re(problem, userno);
+                const float *x_im = _zf_batch.x_im(problem, userno);
+                _write_weights(page, userno, est_idx, scale[userno], [&](size_t radio_idx) {
+                    return sklk_mii_cf_t{x_re[radio_idx], -x_im[radio_idx]};
+                });
             }
         }
+    });
+}
 
-        // Scale relative to largest power
-        const float scale = amplitude_ceiling/std::sqrt(max_power);
+void ref_design_csi_mod::_solve_zf_problem(ref_design_pending_weight_page &pending, size_t est_idx, size_t problem)
+{
+    if (_incremental_factors.empty()) {
+        _zf_batch.solve(problem, 1, _zf_regularization, *_zf_kernels);
+        return;
+    }
 
-        // Normalize the weights
-        for (size_t ch = 0; ch < num_radios; ch++) {
-            for (size_t userno = 0; userno < num_users; userno++) {
-                auto &w = page.get_symbol(ch, userno, sbno);
-                w *= scale;
-            }
+    const size_t num_users = pending.ue_streams.size();
+    const uint64_t *csi_versions = pending.csi_versions.data() + est_idx*num_users;
+    const uint64_t inputs_version = _inputs_versions[pending.resource_blk_no][pending.is_downlink];
+    auto &factor = _incremental_factors[_group_index(pending.resource_blk_no, pending.is_downlink, pending.group_no)*_num_estimations + est_idx];
+
+    if (factor.update(pending.ue_keys.data(), csi_versions, num_users, inputs_version,
+                      _zf_batch, problem, *_zf_kernels, _incremental_drift_threshold)) {
+        _stats.incremental_factorizations++;
+        return;
+    }
+
+    _zf_batch.solve(problem, 1, _zf_regularization, *_zf_kernels);
+    _stats.full_factorizations++;
+    if (_zf_batch.ok(problem))
+        factor.assign(pending.ue_keys.data(), csi_versions, num_users, inputs_version, _zf_batch, problem);
+    else
+        factor.invalidate();
+}
+
+void ref_design_csi_mod::_load_zf_problem(ref_design_pending_weight_page &pending, size_t est_idx, size_t problem)
+{
+    const auto &slots = pending.ue_slots;
+    const size_t store_blk = _store_blk(pending.resource_blk_no);
+    _zf_batch.set_num_users(problem, slots.size());
+    for (size_t userno = 0; userno < slots.size(); userno++) {
+        const sklk_mii_cf_t *user_csi = pending.is_downlink ?
+            _csi_store->calibrated_csi(store_blk, est_idx, slots[userno]) : _csi_store->csi(store_blk, est_idx, slots[userno]);
+        float *a_re = _zf_batch.a_re(problem, userno);
+        float *a_im = _zf_batch.a_im(problem, userno);
+        for (size_t radio_idx = 0; radio_idx < _num_enabled_radios; radio_idx++) {
+            const auto value = user_csi[_enabled_radios[radio_idx]];
+            a_re[radio_idx] = value.real();
+            a_im[radio_idx] = value.imag();
         }
     }
 }
 
-void ref_design_csi_mod::_scale_pages_for_uplink(
-    sklk_phy_weight_page &page, size_t num_users, size_t num_radios, float amplitude_ceiling)
+void ref_design_csi_mod::_update_ue_radio_handles()
 {
-    for (size_t sbno = 0; sbno < NUM_PILOT_SUBBANDS; sbno++)
-    {
-        // Scale each user separately.
-        for (size_t userno = 0; userno < num_users; userno++)
-        {
-            float max_power{};
-            for (size_t ch = 0; ch < num_radios; ch++)
-            {
-                auto &w = page.get_symbol(ch, userno, sbno);
-                max_power = std::max(max_power, sklk_dsp_mag2(w));
-            }
+    // The pages grouping a removed UE radio must not be scheduled any longer
+    for (const auto &handle : _ue_radio_handles) {
+        if (ue_radio_map.count(handle.key) == 0)
+            _mark_ue_radio_pages_dirty(handle.key);
+    }
+
+    _ue_radio_handles.clear();
+    _ue_radio_slots.clear();
+    for (const auto &[key, ue_radio] : ue_radio_map) {
+        const size_t slot = _resolve_slot(key, ue_radio);
+        _ue_radio_handles.push_back({key, slot, ue_radio});
+        _ue_radio_slots.emplace(key, slot);
+    }
+    _ue_radio_handles_valid = true;
+}
 
-            const float scale = amplitude_ceiling / 1.0;
-            for (size_t ch = 0; ch < num_radios; ch++)
-            {
-                auto &w = page.get_symbol(ch, userno, sbno);
-                w *= scale;
+size_t ref_design_csi_mod::_get_slot(size_t key, const sklk_phy_ue_radio &ue_radio)
+{
+    auto it = _ue_radio_slots.find(key);
+    if (it != _ue_radio_slots.end())
+        return it->second;
+
+    // CSI still in flight for a removed UE radio must not land in the slot it left, which may be reused already
+    if (ue_radio_map.count(key) == 0)
+        return ref_design_csi_store::invalid_slot;
+
+    // CSI for a UE radio that joined since the handles were updated
+    const size_t slot = _resolve_slot(key, ue_radio);
+    if (slot != ref_design_csi_store::invalid_slot)
+        _ue_radio_slots.emplace(key, slot);
+    return slot;
+}
+
+size_t ref_design_csi_mod::_resolve_slot(size_t key, const sklk_phy_ue_radio &ue_radio)
+{
+    auto ue_radio_container = _get_container(key, ue_radio);
+    if (not ue_radio_container)
+        return ref_design_csi_store::invalid_slot;
+    ue_radio_container->ue_radio_key.store(key, std::memory_order_relaxed);
+    size_t slot = ue_radio_container->slot.load(std::memory_order_relaxed);
+    if (slot != ref_design_csi_store::invalid_slot)
+        return slot;
+
+    // The UE radio joined a full store.  Growing allocates, but only once each time the UE radios double.
+    if (_csi_store->grow())
+        sklk_mii_log::warn("{}: CSI store grown to {} UE radios, raise max_csi_ue_radios to size it up front", get_name(), _csi_store->num_slots());
+    slot = _csi_store->allocate();
+    // Our reference keeps the container alive, so its destructor releases the slot set here
+    ue_radio_container->slot.store(slot, std::memory_order_relaxed);
+    return slot;
+}
+
+std::shared_ptr<ref_design_csi_radio_container> ref_design_csi_mod::_get_container(
+    size_t key [[maybe_unused]], const sklk_phy_ue_radio &ue_radio)
+{
+    auto ptr = sklk_phy_mod_ue_access::get_container(get_name(), ue_radio);
+    return std::dynamic_pointer_cast<ref_design_csi_radio_container>(ptr);
+}
+
+sklk_phy_weight_page_id_t ref_design_csi_mod::_new_weight_page(const ref_design_pending_weight_page &pending)
+{
+    return _loader->get_weight_page(_last_frame_time, pending.resource_blk_no, pending.is_downlink, pending.ue_streams).initialize().first;
+}
+
+sklk_phy_weight_page &ref_design_csi_mod::_weight_page(const sklk_phy_weight_page_id_t &page_hdl)
+{
+    return *sklk_phy_mod_page_access::get_page_from_hdl(page_hdl);
+}
+
+bool ref_design_csi_mod::_page_is_valid(const sklk_phy_weight_page_id_t &page_hdl)
+{
+    return sklk_phy_mod_page_access::page_is_valid(page_hdl);
+}
+
+void ref_design_csi_mod::_set_page_status(const sklk_phy_weight_page_id_t &page_hdl, bool ok)
+{
+    sklk_phy_mod_page_access::set_page_status(_last_frame_time, page_hdl, ok);
+}
+
+size_t ref_design_csi_mod::_ue_radio_key(const sklk_phy_ue_stream &ue_stream)
+{
+    return ref_design_ue_radio_key(ue_stream);
+}
+
+void ref_design_csi_mod::_update_enabled_radios()
+{
+    _num_enabled_radios = 0;
+    for(size_t radio_ch{0}; radio_ch < SKLK_PHY_MAX_RADIOS; radio_ch++) {
+        if (_radio_enabled[radio_ch])
+            _enabled_radios[_num_enabled_radios++] = radio_ch;
+    }
+}
+
+nlohmann::json ref_design_csi_mod::dump_stats() const
+{
+    const size_t hits = _stats.weight_cache_hits.load();
+    const size_t misses = _stats.weight_cache_misses.load();
+    return {
+        {"full_factorizations", _stats.full_factorizations.load()},
+        {"incremental_factorizations", _stats.incremental_factorizations.load()},
+        {"stale_drops", _stats.stale_drops.load()},
+        {"deferred_pages", _stats.deferred_pages.load()},
+        {"coalesced_csi", _stats.coalesced_csi.load()},
+        {"reused_pages", _stats.reused_pages.load()},
+        {"recomputed_pages", _stats.recomputed_pages.load()},
+        {"idle_runs", _stats.idle_runs.load()},
+        {"initialized_pages", _stats.initialized_pages.load()},
+        {"reused_weight_pages", _stats.reused_weight_pages.load()},
+        {"unpooled_pages", _stats.unpooled_pages.load()},
+        {"weight_cache_hits", hits},
+        {"weight_cache_misses", misses},
+        {"weight_cache_hit_rate", hits + misses ? double(hits)/double(hits + misses) : 0.0},
+    };
+}
+
+void ref_design_csi_mod::_mark_dirty(size_t resource_blk_no, bool is_downlink)
+{
+    _dirty_pages.at(resource_blk_no)[is_downlink] = true;
+    _work_pending = true;
+}
+
+void ref_design_csi_mod::_mark_dirty(size_t resource_blk_no)
+{
+    _mark_dirty(resource_blk_no, true);
+    _mark_dirty(resource_blk_no, false);
+}
+
+void ref_design_csi_mod::_mark_all_dirty()
+{
+    for (auto &dirty : _dirty_pages)
+        dirty.fill(true);
+    _work_pending = true;
+}
+
+void ref_design_csi_mod::_index_group_keys(size_t resource_blk_no, bool is_downlink, bool grouped)
+{
+    const size_t bit = resource_blk_no*2 + is_downlink;
+    for (size_t group_no = 0; group_no < _indexed_groups[resource_blk_no][is_downlink]; group_no++) {
+        for (size_t key : _group_keys[_group_index(resource_blk_no, is_downlink, group_no)]) {
+            if (grouped) {
+                _ue_radio_pages[key].set(bit);
+                continue;
             }
+            auto it = _ue_radio_pages.find(key);
+            if (it != _ue_radio_pages.end() and it->second.reset(bit).none())
+                _ue_radio_pages.erase(it);
         }
     }
 }
+
+void ref_design_csi_mod::_scale_weights(
+    bool is_downlink, const float *power, const float *max_power, size_t num_users, float *scale) const
+{
+    if (not is_downlink) {
+        std::fill(scale, scale + num_users, RX_BF_SCALE_FLT);
+        return;
+    }
+
+    // Normalize the weights of each user, then scale the largest normalized weight of any user to the ceiling
+    float max_normalized_power{};
+    for (size_t userno = 0; userno < num_users; userno++)
+        max_normalized_power = std::max(max_normalized_power, max_power[userno]/power[userno]);
+    const float ceiling_scale = TX_BF_SCALE_FLT/std::sqrt(max_normalized_power);
+    for (size_t userno = 0; userno < num_users; userno++)
+        scale[userno] = ceiling_scale/std::sqrt(power[userno]);
+}
+
+template <typename Fn>
+void ref_design_csi_mod::_write_weights(sklk_phy_weight_page &page, size_t userno, size_t est_idx, float scale, Fn &&weight) const
+{
+    // Walk every radio once, writing the enabled radios in order and zeroing the disabled ones
+    size_t radio_idx{0};
+    for (size_t radio_ch = 0; radio_ch < SKLK_PHY_MAX_RADIOS; radio_ch++) {
+        auto &w = page.get_symbol(radio_ch, userno, est_idx);
+        if (radio_idx < _num_enabled_radios and _enabled_radios[radio_idx] == radio_ch)
+            w = weight(radio_idx++)*scale;
+        else
+            w = sklk_mii_cf_t{};
+    }
+}
+
+nlohmann::json ref_design_csi_mod::dump_thread_placement() const
+{
+    if (not _initialized.load(std::memory_order_acquire))
+        return nullptr;
+    return _thread_placement;
+}
@@ -1,64 +1,230 @@
 #pragma once
 
 #include "api.hpp"
+#include "batched_kernels.hpp"
+#include "config.hpp"
+#include "csi_store.hpp"
+#include "group_selection.hpp"
+#include "incremental_factor.hpp"
+#include "weight_cache.hpp"
+#include "worker_pool.hpp"
 
 #include <sklkphy/common.hpp>
 #include <sklkphy/mimo_rrh_scheduler.hpp>
 #include <sklkphy/modding.hpp>
 
 #include <array>
+#include <bitset>
+#include <chrono>
 #include <random>
+#include <unordered_map>
 
 extern const std::string ref_design_csi_mod_name;
+
+//! Name of a CSI shard, the first shard keeps ref_design_csi_mod_name
+SKLK_PHY_MOD_REFDESIGN_API std::string ref_design_csi_mod_shard_name(size_t shard_no);
 class ref_design_mod_loader;
 
-class SKLK_PHY_MOD_REFDESIGN_API ref_design_csi_estimation
+//! [CSI module container]
+class SKLK_PHY_MOD_REFDESIGN_API ref_design_csi_radio_container : public sklk_phy_mod_container
 {
-    sklk_phy_csi_vec _data{};
-    bool _valid{false};
-    size_t _frame_time;
+    std::shared_ptr<ref_design_csi_store> _store;
+
 public:
-    void set_csi(size_t frame_time, const sklk_phy_csi_vec &csi) {
-        _frame_time = frame_time;
-        _data = csi;
-        _valid = true;
-    }
+    explicit ref_design_csi_radio_container(std::shared_ptr<ref_design_csi_store> store);
+    ~ref_design_csi_radio_container() override;
+
+    /**
+     * Slot of this UE radio in the CSI store.  ref_design_csi_store::invalid_slot when the store was full, until the
+     * CSI module thread grew the store and set it.
+     */
+    std::atomic_size_t slot;
+    //! Key of this UE radio, set by the CSI module thread, invalid_key until the CSI module saw the UE radio
+    std::atomic_size_t ue_radio_key{invalid_key};
 
-    const sklk_phy_csi_vec & data() const { return _data; }
-    [[nodiscard]] bool is_valid() const {return _valid;}
+    static constexpr size_t invalid_key{SIZE_MAX};
 };
+//! [CSI module container]
 
-class ref_design_csi_estimations : public std::array<ref_design_csi_estimation, SKLK_PHY_MAX_ESTIMATIONS>
+/**
+ * Key of the UE radio of a stream.  Groups and proportional-fair entries are keyed by UE radio, so this is how a
+ * change of a stream finds them.
+ *
+ * @return ref_design_csi_radio_container::invalid_key when the CSI module has not seen the UE radio yet
+ */
+SKLK_PHY_MOD_REFDESIGN_API size_t ref_design_ue_radio_key(const sklk_phy_ue_stream &ue_stream);
+
+//! A UE radio with ready CSI that can be added to a group
+struct ref_design_group_candidate
 {
-public:
-    [[nodiscard]] bool ready() const {
-        return std::all_of(this->begin(), this->end(),[](const auto & est) {return est.is_valid(); });
-    }
+    size_t key;
+    size_t slot;
+    //! Points into the UE radio handles, which outlive the candidate
+    const sklk_phy_ue_stream *ue_stream;
 };
 
-class SKLK_PHY_MOD_REFDESIGN_API ref_design_csi_radio_container : public sklk_phy_mod_container
+//! A UE radio of the module's map with its container resolved to a CSI store slot
+struct ref_design_ue_radio_handle
 {
-public:
-    std::array<ref_design_csi_estimations, SKLK_PHY_MAX_BANDS> csi{};
+    size_t key;
+    size_t slot;
+    sklk_phy_ue_radio ue_radio;
+};
+
+//! A weight page whose estimates are being calculated by the worker pool
+struct ref_design_pending_weight_page
+{
+    size_t resource_blk_no{};
+    bool is_downlink{};
+    //! Which of the disjoint groups of the block this page is for
+    size_t group_no{};
+    std::vector<sklk_phy_ue_stream> ue_streams{};
+    //! UE radio keys of ue_streams
+    std::vector<size_t> ue_keys{};
+    //! CSI store slots of ue_streams
+    std::vector<size_t> ue_slots{};
+    //! CSI version of each user for each estimation, indexed by [est_idx*ue_streams.size() + userno]
+    std::vector<uint64_t> csi_versions{};
+    //! Material CSI version of each user, laid out like csi_versions, so CSI within the change threshold hits the cache
+    std::vector<uint64_t> material_versions{};
+    sklk_phy_weight_page_id_t page_hdl{};
+    std::atomic_bool failed{false};
+    //! The weights were copied from the weight cache, so the page is not calculated
+    bool cached{false};
+};
+
+//! A weight page kept for reuse by one group, with the UE radios it was initialized for
+struct ref_design_pooled_weight_page
+{
+    sklk_phy_weight_page_id_t page_hdl{};
+    std::vector<size_t> ue_keys{};
+    uint64_t last_used{0};
+};
+
+//! Counters reported by the get_csi_stats RPC command
+struct ref_design_csi_stats
+{
+    std::atomic_size_t full_factorizations{0};
+    std::atomic_size_t incremental_factorizations{0};
+    //! UE radios left out of a group because their CSI was older than max_csi_age_frames
+    std::atomic_size_t stale_drops{0};
+    //! Dirty pages left for a later pass because they did not fit in csi_compute_budget_us
+    std::atomic_size_t deferred_pages{0};
+    //! Pages kept because all new CSI of their block was within csi_change_threshold
+    std::atomic_size_t reused_pages{0};
+    //! Pages calculated again because their inputs changed
+    std::atomic_size_t recomputed_pages{0};
+    //! CSI messages replaced by a newer one for the same UE radio, block, and estimation in the same drain
+    std::atomic_size_t coalesced_csi{0};
+    //! Calls of run_once that found no new message and no dirty page, and returned without scanning the blocks
+    std::atomic_size_t idle_runs{0};
+    //! Weight pages requested and initialized, and pages of the page pool filled again
+    std::atomic_size_t initialized_pages{0};
+    std::atomic_size_t reused_weight_pages{0};
+    //! Pages requested while every page of the group's pool was still in use, so they are not kept for reuse
+    std::atomic_size_t unpooled_pages{0};
+    //! Pages copied from the weight cache, and pages looked up in it but calculated
+    std::atomic_size_t weight_cache_hits{0};
+    std::atomic_size_t weight_cache_misses{0};
+};
+
+//! A dirty page waiting to be recalculated
+struct ref_design_weight_job
+{
+    //! Frames between the CSI the current page was calculated from and the next schedule request
+    size_t staleness;
+    size_t resource_blk_no;
+    bool is_downlink;
 };
 
 class SKLK_PHY_MOD_REFDESIGN_API ref_design_csi_mod : public sklk_phy_modding
 {
-    bool _initialized{false};
+    //! Set once the thread policy was applied on the module thread, _thread_placement is constant after
+    std::atomic_bool _initialized{false};
+    const ref_design_thread_policy _thread_policy;
+    ref_design_thread_placement _thread_placement{};
     ref_design_mod_loader *_loader;
     const size_t _num_resouce_blks;
+    //! Resource blocks owned by this shard, messages of other blocks are left to the other shards
+    const size_t _first_resource_blk;
+    const size_t _end_resource_blk;
     const size_t _max_spatial_streams;
     const size_t _num_estimations;
+    const size_t _groups_per_block;
+    const ref_design_weight_solver _weight_solver;
+    const float _rzf_regularization;
+    //! Kernels of the batched Cholesky solver, nullptr to solve each estimate with armadillo
+    const ref_design_complex_kernels *_zf_kernels;
+    const float _zf_regularization;
+    const bool _incremental_factorization;
+    const double _incremental_drift_threshold;
+    const size_t _max_csi_age_frames;
+    const std::chrono::microseconds _compute_budget;
+    //! Time after the last pass with work during which run_once asks to be called again instead of sleeping
+    const std::chrono::microseconds _busy_poll;
+    std::chrono::steady_clock::time_point _last_work_time{};
+    //! A page was marked dirty since the last pass, or a pass left dirty pages over
+    bool _work_pending{false};
     std::mt19937 _randomizer;
     std::array<bool, SKLK_PHY_MAX_RADIOS> _radio_enabled{};
-    std::array<
-        std::array<sklk_phy_csi_vec, SKLK_PHY_MAX_ESTIMATIONS>,
-        SKLK_PHY_MAX_BANDS> _cc_values{};
+    std::shared_ptr<ref_design_csi_store> _csi_store;
+    // Resolved once per change of the UE radio map so the hot loops do no container lookups or casts
+    std::vector<ref_design_ue_radio_handle> _ue_radio_handles{};
+    std::unordered_map<size_t, size_t> _ue_radio_slots{};
+    bool _ue_radio_handles_valid{false};
+    //! Pages grouping each UE radio, bit resource_blk_no*2 + is_downlink, for UE radios in at least one group
+    std::unordered_map<size_t, std::bitset<SKLK_PHY_MAX_BANDS*2>> _ue_radio_pages{};
+    //! Groups of each page entered in _ue_radio_pages, indexed by [resource_blk_no][is_downlink]
+    std::array<std::array<size_t, 2>, SKLK_PHY_MAX_BANDS> _indexed_groups{};
+    std::vector<ref_design_group_candidate> _candidates{};
+    std::vector<ref_design_group_candidate> _group{};
+    ref_design_group_selector _group_selector;
+    std::vector<size_t> _selected{};
+    std::array<size_t, SKLK_PHY_MAX_RADIOS> _enabled_radios{};
+    size_t _num_enabled_radios{0};
 
     size_t _last_frame_time{0};
 
+    //! Changed whenever the radios or calibration change the channel matrix, indexed by [resource_blk_no][is_downlink]
+    std::array<std::array<uint64_t, 2>, SKLK_PHY_MAX_BANDS> _inputs_versions{};
+    //! UE radio keys of the last group of each page, in the order used for the page, indexed by _group_index(...)
+    std::vector<std::vector<size_t>> _group_keys{};
+    //! Factors kept for incremental updates, indexed by [_group_index(...)*_num_estimations + est_idx]
+    std::vector<ref_design_incremental_factor> _incremental_factors{};
+    ref_design_csi_stats _stats{};
+
+    //! Pages whose inputs changed since they were last calculated, indexed by [resource_blk_no][is_downlink]
+    std::array<std::array<bool, 2>, SKLK_PHY_MAX_BANDS> _dirty_pages{};
+    //! CSI within csi_change_threshold arrived for the block since the last pass
+    std::array<bool, SKLK_PHY_MAX_BANDS> _unchanged_csi{};
+    //! Frame time at which the oldest CSI of the last group of each page expires, indexed by [resource_blk_no][is_downlink]
+    std::array<std::array<size_t, 2>, SKLK_PHY_MAX_BANDS> _page_expiry{};
+    //! Earliest _page_expiry of the owned pages, run_once does not go idle once it has passed
+    size_t _min_page_expiry{SIZE_MAX};
+    //! Frame time of the CSI each page was last calculated from, indexed by [resource_blk_no][is_downlink]
+    std::array<std::array<size_t, 2>, SKLK_PHY_MAX_BANDS> _page_frame_times{};
+    std::vector<ref_design_weight_job> _jobs{};
+    //! Moving average of the time to calculate the groups of one block and direction, used to fit a pass into the budget
+    double _job_cost_us{0.0};
+
+    //! Pages calculated in the current pass, filled before the per-frame barrier of the worker pool
+    std::vector<ref_design_pending_weight_page> _pending_pages;
+    //! CSI messages of the owned blocks drained in one run_once, and the order they are stored in
+    std::vector<sklk_phy_mod_csi_msg_t> _csi_batch{};
+    std::vector<uint32_t> _csi_order{};
+    size_t _num_pending_pages{0};
+    //! Pages kept for reuse, indexed by [_group_index(...)*_pages_per_group + n]
+    const size_t _pages_per_group;
+    std::vector<ref_design_pooled_weight_page> _page_pool{};
+    uint64_t _page_pool_clock{0};
+    ref_design_worker_pool _worker_pool;
+    ref_design_zf_batch _zf_batch{};
+    ref_design_weight_cache _weight_cache;
+
 public:
-    ref_design_csi_mod(ref_design_mod_loader *loader, const mimo_rrh_scheduler_config &config);
+    //! Shard shard_no of num_shards, owning an equal range of the resource blocks
+    ref_design_csi_mod(ref_design_mod_loader *loader, const mimo_rrh_scheduler_config &config, const ref_design_config &mod_config,
+                       size_t shard_no = 0, size_t num_shards = 1);
     ~ref_design_csi_mod() override = default;
 
     void ue_changed(size_t key, const sklk_phy_ue &ue, bool is_new) override;
@@ -71,12 +237,85 @@ public:
 
     void csi_update(size_t frame_time, size_t key, const sklk_phy_ue_radio &ue_radio, size_t resource_blk_no, size_t est_idx, const sklk_phy_csi_vec &vec);
 
+    [[nodiscard]] bool owns(size_t resource_blk_no) const { return _owns(resource_blk_no); }
+
+    //! Queue a message of an owned block, called by ref_design_csi_router on its thread
+    //! @return false when the queue is full
+    bool route_csi(sklk_phy_mod_csi_msg_t &&msg) { return _msg_queues.csi.send(std::move(msg)); }
+    bool route_cc(const sklk_phy_mod_cc_msg_t &msg) { return _msg_queues.cc.send(msg); }
+
+    [[nodiscard]] nlohmann::json dump_stats() const;
+
+    //! Placement applied to the module thread, null until the thread first ran
+    [[nodiscard]] nlohmann::json dump_thread_placement() const;
+
+protected:
+    // The containers and weight pages of the PHY, overridden by the tests to run the module without a PHY
+    //! @return nullptr when the UE radio has no container of this module
+    virtual std::shared_ptr<ref_design_csi_radio_container> _get_container(size_t key, const sklk_phy_ue_radio &ue_radio);
+    //! Request and initialize a page for the users of the pending page
+    [[nodiscard]] virtual sklk_phy_weight_page_id_t _new_weight_page(const ref_design_pending_weight_page &pending);
+    //! Called by the worker pool threads
+    [[nodiscard]] virtual sklk_phy_weight_page &_weight_page(const sklk_phy_weight_page_id_t &page_hdl);
+    [[nodiscard]] virtual bool _page_is_valid(const sklk_phy_weight_page_id_t &page_hdl);
+    virtual void _set_page_status(const sklk_phy_weight_page_id_t &page_hdl, bool ok);
+    [[nodiscard]] virtual size_t _ue_radio_key(const sklk_phy_ue_stream &ue_stream);
+
 private:
-    void _calculate_weights();
+    //! @return true when dirty pages were left for a later pass
+    bool _calculate_weights();
     void _calculate_weights(size_t resource_blk_no, bool is_downlink);
-    void _calculate_weight_page(const std::vector<sklk_phy_ue_stream> &ue_streams, size_t resource_blk_no, bool is_downlink);
-    bool _calculate_weight_page_estimate(const sklk_phy_weight_page_id_t &page_hdl, size_t resource_blk_no, size_t est_idx, bool is_downlink);
+    void _set_csi(size_t frame_time, size_t key, const sklk_phy_ue_radio &ue_radio, size_t resource_blk_no, size_t est_idx, const sklk_phy_csi_vec &vec);
+    //! Store the newest CSI of every UE radio, block, and estimation in _csi_batch
+    void _apply_csi_batch();
+    [[nodiscard]] size_t _select_weight_jobs();
+    void _queue_weight_page(const std::vector<ref_design_group_candidate> &group, size_t resource_blk_no, bool is_downlink, size_t group_no);
+    //! A page of the group's pool bound to the users of the page when one is free, otherwise a new page
+    [[nodiscard]] sklk_phy_weight_page_id_t _get_weight_page(const ref_design_pending_weight_page &pending);
+    void _finish_weight_page(ref_design_pending_weight_page &pending);
+    void _publish_weight_pages(size_t first_page, size_t num_pages);
+    [[nodiscard]] ref_design_weight_cache_key _weight_cache_key(const ref_design_pending_weight_page &pending) const;
+    //! Copy the weights of the same group with the same inputs into the page, @return true when they were cached
+    bool _load_cached_weights(ref_design_pending_weight_page &pending);
+    void _cache_weights(const ref_design_pending_weight_page &pending);
+
+    [[nodiscard]] size_t _group_index(size_t resource_blk_no, bool is_downlink, size_t group_no) const
+    {
+        return (_store_blk(resource_blk_no)*2 + is_downlink)*_groups_per_block + group_no;
+    }
+    [[nodiscard]] bool _owns(size_t resource_blk_no) const
+    {
+        return resource_blk_no >= _first_resource_blk and resource_blk_no < _end_resource_blk;
+    }
+    //! Index of an owned resource block in the CSI store and the per-group state
+    [[nodiscard]] size_t _store_blk(size_t resource_blk_no) const
+    {
+        return resource_blk_no - _first_resource_blk;
+    }
+    void _calculate_weight_pages_batched();
+    void _load_zf_problem(ref_design_pending_weight_page &pending, size_t est_idx, size_t problem);
+    void _solve_zf_problem(ref_design_pending_weight_page &pending, size_t est_idx, size_t problem);
+    bool _calculate_weight_page_estimate(const ref_design_pending_weight_page &pending, size_t est_idx);
+
+    //! The latest CSI or schedule request, so CSI keeps aging when every UE radio goes silent
+    [[nodiscard]] size_t _current_frame_time() const;
+    [[nodiscard]] size_t _oldest_usable_frame_time() const;
+    void _update_ue_radio_handles();
+    size_t _get_slot(size_t key, const sklk_phy_ue_radio &ue_radio);
+    //! Slot of the UE radio's container, growing the store when the UE radio joined a full store
+    size_t _resolve_slot(size_t key, const sklk_phy_ue_radio &ue_radio);
+    void _update_enabled_radios();
+
+    static const ref_design_complex_kernels *_select_zf_kernels(const ref_design_config &mod_config);
+
+    void _mark_dirty(size_t resource_blk_no, bool is_downlink);
+    void _mark_dirty(size_t resource_blk_no);
+    void _mark_all_dirty();
+    //! Mark the pages whose last group contains the UE radio
+    void _mark_ue_radio_pages_dirty(size_t key);
+    void _index_group_keys(size_t resource_blk_no, bool is_downlink, bool grouped);
 
-    void _scale_pages_for_uplink(sklk_phy_weight_page &page, size_t num_users, size_t num_radios, float amplitude_ceiling);
-    void _scale_pages_for_downlink(sklk_phy_weight_page &page, size_t num_users, size_t num_radios, float amplitude_ceiling);
+    void _scale_weights(bool is_downlink, const float *power, const float *max_power, size_t num_users, float *scale) const;
+    template <typename Fn>
+    void _write_weights(sklk_phy_weight_page &page, size_t userno, size_t est_idx, float scale, Fn &&weight) const;
 };
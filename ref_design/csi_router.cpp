@@ -0,0 +1,78 @@
+#include "csi_router.hpp"
+#include "csi_mod.hpp"
+#include "loader.hpp"
+
+#include <sklk-mii/simple_log.hpp>
+
+const std::string ref_design_csi_router_name{"csi_router"};
+
+ref_design_csi_router::ref_design_csi_router(
+    ref_design_mod_loader *loader, const ref_design_config &mod_config, size_t num_resource_blks,
+    std::vector<std::shared_ptr<ref_design_csi_mod>> shards) :
+    sklk_phy_modding(ref_design_csi_router_name),
+    _thread_policy(ref_design_pin_thread_policy(mod_config.csi_thread, shards.size())),
+    _loader(loader),
+    _shards(std::move(shards)),
+    _shard_of_blk(num_resource_blks)
+{
+    for (size_t resource_blk_no = 0; resource_blk_no < num_resource_blks; resource_blk_no++) {
+        for (size_t shard_no = 0; shard_no < _shards.size(); shard_no++) {
+            if (_shards[shard_no]->owns(resource_blk_no))
+                _shard_of_blk[resource_blk_no] = shard_no;
+        }
+    }
+}
+
+bool ref_design_csi_router::run_once()
+{
+    if (not _initialized.load(std::memory_order_relaxed)) {
+        _thread_placement = ref_design_apply_thread_policy(get_name(), _thread_policy, 0.6);
+        _initialized.store(true, std::memory_order_release);
+    }
+
+    sklk_phy_mod_cc_msg_t cc_msg;
+    while (_msg_queues.cc.pop(cc_msg))
+    {
+        auto *shard = _shard(std::get<2>(cc_msg));
+        if (shard == nullptr)
+            continue;
+        if (shard->route_cc(cc_msg))
+            _stats.routed_cc++;
+        else
+            _stats.full_drops++;
+    }
+
+    sklk_phy_mod_csi_msg_t csi_msg;
+    size_t frame_time{0};
+    while (_msg_queues.csi.pop(csi_msg))
+    {
+        frame_time = std::get<0>(csi_msg);
+        auto *shard = _shard(std::get<3>(csi_msg));
+        if (shard == nullptr)
+            continue;
+        if (shard->route_csi(std::move(csi_msg)))
+            _stats.routed_csi++;
+        else
+            _stats.full_drops++;
+    }
+    // Shards without CSI of their own still see time pass, so the CSI of their groups expires
+    if (frame_time)
+        _loader->last_csi_frame_time.store(frame_time, std::memory_order_relaxed);
+    return false;
+}
+
+nlohmann::json ref_design_csi_router::dump_stats() const
+{
+    return {
+        {"routed_csi", _stats.routed_csi.load()},
+        {"routed_cc", _stats.routed_cc.load()},
+        {"full_drops", _stats.full_drops.load()},
+    };
+}
+
+nlohmann::json ref_design_csi_router::dump_thread_placement() const
+{
+    if (not _initialized.load(std::memory_order_acquire))
+        return nullptr;
+    return _thread_placement;
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include "api.hpp"
+#include "config.hpp"
+
+#include <sklkphy/modding.hpp>
+
+#include <atomic>
+#include <memory>
+#include <vector>
+
+extern const std::string ref_design_csi_router_name;
+class ref_design_mod_loader;
+class ref_design_csi_mod;
+
+//! Counters reported under "router" by the get_csi_stats RPC command
+struct ref_design_csi_router_stats
+{
+    std::atomic_size_t routed_csi{0};
+    std::atomic_size_t routed_cc{0};
+    //! Messages lost because the queue of their shard was full
+    std::atomic_size_t full_drops{0};
+};
+
+/**
+ * Forwards the CSI and calibration messages to the CSI shard owning their resource block.
+ *
+ * The PHY delivers every message to every subscriber, so with several shards this module is the only subscriber
+ * and each shard only receives, wakes up for, and copies the messages of its own blocks.
+ */
+class SKLK_PHY_MOD_REFDESIGN_API ref_design_csi_router : public sklk_phy_modding
+{
+    std::atomic_bool _initialized{false};
+    const ref_design_thread_policy _thread_policy;
+    ref_design_thread_placement _thread_placement{};
+    ref_design_mod_loader *_loader;
+    std::vector<std::shared_ptr<ref_design_csi_mod>> _shards;
+    //! Shard owning each resource block
+    std::vector<uint8_t> _shard_of_blk;
+    ref_design_csi_router_stats _stats{};
+
+public:
+    ref_design_csi_router(ref_design_mod_loader *loader, const ref_design_config &mod_config, size_t num_resource_blks,
+                          std::vector<std::shared_ptr<ref_design_csi_mod>> shards);
+    ~ref_design_csi_router() override = default;
+
+    bool run_once() override;
+
+    [[nodiscard]] nlohmann::json dump_stats() const;
+
+    //! Placement applied to the module thread, null until the thread first ran
+    [[nodiscard]] nlohmann::json dump_thread_placement() const;
+
+private:
+    [[nodiscard]] ref_design_csi_mod *_shard(size_t resource_blk_no) const
+    {
+        return resource_blk_no < _shard_of_blk.size() ? _shards[_shard_of_blk[resource_blk_no]].get() : nullptr;
+    }
+};
@@ -0,0 +1,167 @@
+#include "csi_store.hpp"
+
+#include <algorithm>
+#include <complex>
+#include <cstdlib>
+#include <new>
+
+void ref_design_csi_store::aligned_free::operator()(sklk_mii_cf_t *ptr) const
+{
+    std::free(ptr);
+}
+
+static sklk_mii_cf_t *allocate_rows(size_t num_rows)
+{
+    const size_t size = std::max<size_t>(num_rows, 1)*ref_design_csi_store::row_stride*sizeof(sklk_mii_cf_t);
+    auto *ptr = static_cast<sklk_mii_cf_t *>(std::aligned_alloc(64, size));
+    if (ptr == nullptr)
+        throw std::bad_alloc();
+    std::fill_n(ptr, size/sizeof(sklk_mii_cf_t), sklk_mii_cf_t{});
+    return ptr;
+}
+
+ref_design_csi_store::ref_design_csi_store(size_t num_bands, size_t num_estimations, size_t num_slots, float change_threshold) :
+    _num_bands(num_bands),
+    _num_estimations(num_estimations),
+    _num_slots(num_slots),
+    _change_threshold2(change_threshold*change_threshold),
+    _entries(num_bands*num_estimations*num_slots)
+{
+    // Hand out the lowest slots first
+    _free_slots.reserve(num_slots);
+    for (size_t slot = num_slots; slot-- > 0;)
+        _free_slots.push_back(slot);
+}
+
+void ref_design_csi_store::allocate_arenas()
+{
+    if (_csi)
+        return;
+    const size_t num_rows = _num_bands*_num_estimations*_num_slots;
+    _csi.reset(allocate_rows(num_rows));
+    _calibrated_csi.reset(allocate_rows(num_rows));
+    _calibration.reset(allocate_rows(_num_bands*_num_estimations));
+    if (_change_threshold2 > 0.0f)
+        _reference_csi.reset(allocate_rows(num_rows));
+}
+
+bool ref_design_csi_store::grow()
+{
+    std::lock_guard guard(_free_lock);
+    if (not _free_slots.empty())
+        return false;
+
+    // The slots of a band and estimation are consecutive rows, so every run of rows moves to its new start
+    const size_t old_slots = _num_slots;
+    const size_t new_slots = std::max<size_t>(2*old_slots, 1);
+    const size_t num_runs = _num_bands*_num_estimations;
+    auto relayout = [&](std::unique_ptr<sklk_mii_cf_t[], aligned_free> &arena) {
+        if (not arena)
+            return;
+        std::unique_ptr<sklk_mii_cf_t[], aligned_free> grown(allocate_rows(num_runs*new_slots));
+        for (size_t run = 0; run < num_runs; run++)
+            std::copy_n(arena.get() + run*old_slots*row_stride, old_slots*row_stride, grown.get() + run*new_slots*row_stride);
+        arena = std::move(grown);
+    };
+    relayout(_csi);
+    relayout(_calibrated_csi);
+    relayout(_reference_csi);
+
+    std::vector<entry> entries(num_runs*new_slots);
+    for (size_t run = 0; run < num_runs; run++)
+        std::copy_n(_entries.begin() + run*old_slots, old_slots, entries.begin() + run*new_slots);
+    _entries = std::move(entries);
+    _num_slots = new_slots;
+
+    // Hand out the lowest new slots first
+    for (size_t slot = new_slots; slot-- > old_slots;)
+        _free_slots.push_back(slot);
+    return true;
+}
+
+size_t ref_design_csi_store::allocate()
+{
+    std::lock_guard guard(_free_lock);
+    if (_free_slots.empty())
+        return invalid_slot;
+    const size_t slot = _free_slots.back();
+    _free_slots.pop_back();
+
+    for (size_t band = 0; band < _num_bands; band++) {
+        for (size_t est_idx = 0; est_idx < _num_estimations; est_idx++)
+            _entries[_index(band, est_idx, slot)].valid = false;
+    }
+    return slot;
+}
+
+void ref_design_csi_store::release(size_t slot)
+{
+    if (slot == invalid_slot)
+        return;
+    std::lock_guard guard(_free_lock);
+    assert(std::find(_free_slots.begin(), _free_slots.end(), slot) == _free_slots.end());
+    _free_slots.push_back(slot);
+}
+
+bool ref_design_csi_store::set_csi(size_t band, size_t est_idx, size_t slot, size_t frame_time, const sklk_phy_csi_vec &csi)
+{
+    assert(_csi);
+    const size_t index = _index(band, est_idx, slot);
+    bool changed{true};
+    if (_reference_csi) {
+        sklk_mii_cf_t *reference = _reference_csi.get() + index*row_stride;
+        if (_entries[index].valid) {
+            float error{}, power{};
+            for (size_t radio = 0; radio < csi.size(); radio++) {
+                error += std::norm(csi[radio] - reference[radio]);
+                power += std::norm(reference[radio]);
+            }
+            changed = error >= _change_threshold2*power;
+        }
+        if (changed)
+            std::copy(csi.begin(), csi.end(), reference);
+    }
+
+    std::copy(csi.begin(), csi.end(), _csi.get() + index*row_stride);
+    const sklk_mii_cf_t *calibration = _calibration.get() + (band*_num_estimations + est_idx)*row_stride;
+    sklk_mii_cf_t *calibrated = _calibrated_csi.get() + index*row_stride;
+    for (size_t radio = 0; radio < csi.size(); radio++)
+        calibrated[radio] = csi[radio]*calibration[radio];
+    auto &entry = _entries[index];
+    entry.frame_time = frame_time;
+    entry.version++;
+    if (changed)
+        entry.material_version++;
+    entry.valid = true;
+    return changed;
+}
+
+void ref_design_csi_store::set_calibration(size_t band, size_t est_idx, size_t radio, sklk_mii_cf_t value)
+{
+    assert(_csi and band < _num_bands and est_idx < _num_estimations and radio < SKLK_PHY_MAX_RADIOS);
+    _calibration[(band*_num_estimations + est_idx)*row_stride + radio] = value;
+    // Slots of a band and estimation are consecutive rows, so this walks one column of them
+    const size_t first_row = (band*_num_estimations + est_idx)*_num_slots;
+    for (size_t slot = 0; slot < _num_slots; slot++) {
+        const size_t offset = (first_row + slot)*row_stride + radio;
+        _calibrated_csi[offset] = _csi[offset]*value;
+    }
+}
+
+bool ref_design_csi_store::ready(size_t band, size_t slot, size_t oldest_frame_time) const
+{
+    for (size_t est_idx = 0; est_idx < _num_estimations; est_idx++) {
+        const auto &entry = _entries[_index(band, est_idx, slot)];
+        if (not entry.valid or entry.frame_time < oldest_frame_time)
+            return false;
+    }
+    return true;
+}
+
+size_t ref_design_csi_store::oldest_frame_time(size_t band, size_t slot) const
+{
+    size_t oldest{SIZE_MAX};
+    for (size_t est_idx = 0; est_idx < _num_estimations; est_idx++)
+        oldest = std::min(oldest, frame_time(band, est_idx, slot));
+    return oldest;
+}
@@ -0,0 +1,121 @@
+#pragma once
+
+#include "api.hpp"
+
+#include <sklkphy/common.hpp>
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+/**
+ * The CSI of every UE radio in one contiguous arena laid out as [band][estimation][slot][radio].
+ *
+ * Each UE radio container owns a slot for its lifetime.  The arena is sized from the configured number of bands
+ * and estimations, so gathering the channel matrix of a group streams through rows of one block and estimation.
+ * Slots are allocated and released on any thread; everything else is only used by the CSI module thread.  When
+ * every slot is taken, the CSI module thread grows the store, the threads adding UE radios never allocate arenas.
+ *
+ * A second arena with the same layout holds the CSI multiplied by the calibration of each band, estimation, and
+ * radio.  It is kept up to date when either changes, so the downlink weights read it without any multiplies.
+ *
+ * With a change threshold, a third arena keeps the CSI of the last material change of each row.  New CSI is always
+ * stored, and set_csi() reports whether it moved far enough from that reference to be worth new weights.
+ *
+ * The arenas are only allocated by allocate_arenas(), so the CSI module thread touches them first after applying its
+ * NUMA policy.
+ */
+class SKLK_PHY_MOD_REFDESIGN_API ref_design_csi_store
+{
+public:
+    static constexpr size_t invalid_slot{SIZE_MAX};
+    //! Complex values between the start of consecutive rows, a whole number of cache lines
+    static constexpr size_t row_stride{(SKLK_PHY_MAX_RADIOS + 7)/8*8};
+
+private:
+    struct aligned_free
+    {
+        void operator()(sklk_mii_cf_t *ptr) const;
+    };
+
+    struct entry
+    {
+        size_t frame_time{0};
+        uint64_t version{0};
+        uint64_t material_version{0};
+        bool valid{false};
+    };
+
+    const size_t _num_bands;
+    const size_t _num_estimations;
+    //! Only changed by grow(), under _free_lock
+    size_t _num_slots;
+    //! Squared relative error norm below which new CSI is not a material change, 0 to treat every CSI as one
+    const float _change_threshold2;
+    std::unique_ptr<sklk_mii_cf_t[], aligned_free> _csi;
+    std::unique_ptr<sklk_mii_cf_t[], aligned_free> _calibrated_csi;
+    //! One row of calibration values per band and estimation
+    std::unique_ptr<sklk_mii_cf_t[], aligned_free> _calibration;
+    //! Only allocated with a change threshold
+    std::unique_ptr<sklk_mii_cf_t[], aligned_free> _reference_csi;
+    std::vector<entry> _entries;
+
+    std::mutex _free_lock;
+    std::vector<size_t> _free_slots;
+
+public:
+    /**
+     * @param change_threshold relative error norm ||h - h_ref||/||h_ref|| below which set_csi() reports no material
+     * change, 0 to report every CSI as a change
+     */
+    ref_design_csi_store(size_t num_bands, size_t num_estimations, size_t num_slots, float change_threshold = 0.0f);
+
+    ref_design_csi_store(const ref_design_csi_store &) = delete;
+    ref_design_csi_store &operator=(const ref_design_csi_store &) = delete;
+
+    [[nodiscard]] size_t num_slots() const { return _num_slots; }
+
+    //! Allocate and zero the arenas on the calling thread, before any CSI or calibration is set.  Does nothing twice.
+    void allocate_arenas();
+
+    //! @return invalid_slot when every slot is in use
+    [[nodiscard]] size_t allocate();
+    void release(size_t slot);
+
+    //! Double the slots when every slot is in use, keeping the CSI of every slot.  CSI module thread only.
+    //! @return true when the store grew
+    bool grow();
+
+    //! @return false when the CSI is within the change threshold of the CSI of the last material change
+    bool set_csi(size_t band, size_t est_idx, size_t slot, size_t frame_time, const sklk_phy_csi_vec &csi);
+
+    //! Set the calibration of one radio and rescale the calibrated CSI of that radio in every slot.  Starts at zero.
+    void set_calibration(size_t band, size_t est_idx, size_t radio, sklk_mii_cf_t value);
+
+    //! SKLK_PHY_MAX_RADIOS values, followed by the rows of the next slots of the same band and estimation
+    [[nodiscard]] const sklk_mii_cf_t *csi(size_t band, size_t est_idx, size_t slot) const { return _csi.get() + _index(band, est_idx, slot)*row_stride; }
+    //! Like csi(), multiplied by the calibration of each radio
+    [[nodiscard]] const sklk_mii_cf_t *calibrated_csi(size_t band, size_t est_idx, size_t slot) const { return _calibrated_csi.get() + _index(band, est_idx, slot)*row_stride; }
+
+    [[nodiscard]] bool is_valid(size_t band, size_t est_idx, size_t slot) const { return _entries[_index(band, est_idx, slot)].valid; }
+    [[nodiscard]] size_t frame_time(size_t band, size_t est_idx, size_t slot) const { return _entries[_index(band, est_idx, slot)].frame_time; }
+    //! Incremented every time the CSI is set, never reset when the slot is reused
+    [[nodiscard]] uint64_t version(size_t band, size_t est_idx, size_t slot) const { return _entries[_index(band, est_idx, slot)].version; }
+    //! Like version(), only incremented when set_csi() reports a material change
+    [[nodiscard]] uint64_t material_version(size_t band, size_t est_idx, size_t slot) const { return _entries[_index(band, est_idx, slot)].material_version; }
+
+    //! True when every estimation of the band is valid and was set no earlier than oldest_frame_time
+    [[nodiscard]] bool ready(size_t band, size_t slot, size_t oldest_frame_time = 0) const;
+    //! Frame time of the oldest estimation of the band
+    [[nodiscard]] size_t oldest_frame_time(size_t band, size_t slot) const;
+
+private:
+    [[nodiscard]] size_t _index(size_t band, size_t est_idx, size_t slot) const
+    {
+        assert(band < _num_bands and est_idx < _num_estimations and slot < _num_slots);
+        return (band*_num_estimations + est_idx)*_num_slots + slot;
+    }
+};
@@ -0,0 +1,146 @@
+#include "group_selection.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+
+std::string to_string(ref_design_group_selection selection)
+{
+    switch (selection) {
+    case ref_design_group_selection::random: return "random";
+    case ref_design_group_selection::sus: return "sus";
+    case ref_design_group_selection::greedy: return "greedy";
+    }
+    return "unknown";
+}
+
+bool from_string(const std::string &name, ref_design_group_selection &selection)
+{
+    for (auto candidate : {ref_design_group_selection::random, ref_design_group_selection::sus,
+                           ref_design_group_selection::greedy}) {
+        if (name == to_string(candidate)) {
+            selection = candidate;
+            return true;
+        }
+    }
+    return false;
+}
+
+ref_design_group_selector::ref_design_group_selector(ref_design_group_selection selection, float max_correlation, float snr_db) :
+    _selection(selection),
+    _max_correlation(max_correlation),
+    _snr(std::pow(10.0f, snr_db/10.0f))
+{
+}
+
+void ref_design_group_selector::reset(size_t num_candidates, size_t num_radios)
+{
+    _num_candidates = num_candidates;
+    _num_radios = num_radios;
+    if (_selection == ref_design_group_selection::random)
+        return;
+    _residuals.resize(num_candidates*num_radios);
+    _channel_power.resize(num_candidates);
+    _residual_power.resize(num_candidates);
+    _available.resize(num_candidates);
+}
+
+void ref_design_group_selector::select(size_t max_users, std::mt19937 &randomizer, std::vector<size_t> &selected)
+{
+    selected.clear();
+    const size_t num_users = std::min(_num_candidates, max_users);
+    if (_selection != ref_design_group_selection::random) {
+        _select_orthogonal(num_users, selected);
+        return;
+    }
+
+    selected.resize(_num_candidates);
+    std::iota(selected.begin(), selected.end(), 0);
+    if (num_users < _num_candidates) {
+        std::shuffle(selected.begin(), selected.end(), randomizer);
+        selected.resize(num_users);
+    }
+}
+
+void ref_design_group_selector::_select_orthogonal(size_t max_users, std::vector<size_t> &selected)
+{
+    if (_num_candidates == 0)
+        return;
+
+    double mean_power{0.0};
+    for (size_t candidate = 0; candidate < _num_candidates; candidate++) {
+        const sklk_mii_cf_t *h = channel(candidate);
+        float power{};
+        for (size_t radio = 0; radio < _num_radios; radio++)
+            power += std::norm(h[radio]);
+        _channel_power[candidate] = power;
+        _residual_power[candidate] = power;
+        _available[candidate] = power > 0.0f;
+        mean_power += power;
+    }
+    mean_power /= _num_candidates;
+
+    // The CSI is not calibrated to an absolute level, so the SNR applies to the mean channel power
+    const double snr = _snr/mean_power;
+    double sum_rate{0.0};
+    while (selected.size() < max_users) {
+        // The residual power is the gain the candidate would get from zero-forcing against the group
+        size_t best{_num_candidates};
+        for (size_t candidate = 0; candidate < _num_candidates; candidate++) {
+            if (_available[candidate] and (best == _num_candidates or _residual_power[candidate] > _residual_power[best]))
+                best = candidate;
+        }
+        if (best == _num_candidates or _residual_power[best] <= 0.0f)
+            break;
+
+        if (_selection == ref_design_group_selection::greedy) {
+            // Power is shared equally between the users.  The gains of users already in the group are kept at
+            // their value when they were selected, which overestimates the rate of large groups a little.
+            const size_t num_users = selected.size() + 1;
+            double rate{0.0};
+            for (size_t userno : selected)
+                rate += std::log2(1.0 + snr*_residual_power[userno]/num_users);
+            rate += std::log2(1.0 + snr*_residual_power[best]/num_users);
+            if (rate <= sum_rate)
+                break;
+            sum_rate = rate;
+        }
+
+        selected.push_back(best);
+        _available[best] = false;
+        _project_out(best);
+    }
+}
+
+void ref_design_group_selector::_project_out(size_t selected)
+{
+    const sklk_mii_cf_t *g = channel(selected);
+    const float g_power = _residual_power[selected];
+    const float max_correlation2 = _max_correlation*_max_correlation;
+
+    for (size_t candidate = 0; candidate < _num_candidates; candidate++) {
+        if (not _available[candidate])
+            continue;
+
+        sklk_mii_cf_t *r = channel(candidate);
+        sklk_mii_cf_t dot{};
+        for (size_t radio = 0; radio < _num_radios; radio++)
+            dot += r[radio]*std::conj(g[radio]);
+
+        // The residual is orthogonal to the earlier selected users, so its inner product with g equals the
+        // channel's and gives the correlation with the newly selected user
+        if (_selection == ref_design_group_selection::sus and
+            std::norm(dot) > max_correlation2*_channel_power[candidate]*g_power) {
+            _available[candidate] = false;
+            continue;
+        }
+
+        const sklk_mii_cf_t alpha = dot/g_power;
+        float power{};
+        for (size_t radio = 0; radio < _num_radios; radio++) {
+            r[radio] -= alpha*g[radio];
+            power += std::norm(r[radio]);
+        }
+        _residual_power[candidate] = power;
+    }
+}
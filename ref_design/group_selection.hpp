@@ -0,0 +1,73 @@
+#pragma once
+
+#include "api.hpp"
+
+#include <sklkphy/common.hpp>
+
+#include <cstddef>
+#include <random>
+#include <string>
+#include <vector>
+
+/**
+ * Methods for choosing which of the ready UE radios share a weight page.
+ */
+enum class ref_design_group_selection
+{
+    //! A uniformly random subset, ignoring the channels
+    random,
+    //! Semi-orthogonal user selection: pick the strongest channel orthogonal to the group, then drop candidates
+    //! too correlated with it
+    sus,
+    //! Add the user with the largest zero-forcing gain while the estimated sum rate increases
+    greedy,
+};
+
+SKLK_PHY_MOD_REFDESIGN_API std::string to_string(ref_design_group_selection selection);
+
+//! @return false if the name is not a known group selection
+SKLK_PHY_MOD_REFDESIGN_API bool from_string(const std::string &name, ref_design_group_selection &selection);
+
+/**
+ * Selects a group of at most max_users candidates from their channel vectors.
+ *
+ * The channels are loaded with set_channel() after reset().  The scratch buffers are kept between calls so that
+ * selection does not allocate once the largest number of candidates has been seen.
+ */
+class SKLK_PHY_MOD_REFDESIGN_API ref_design_group_selector
+{
+    const ref_design_group_selection _selection;
+    //! Largest |cos| between a candidate and the latest selected user for sus to keep the candidate
+    const float _max_correlation;
+    //! Transmit SNR, linear, used by greedy to estimate the sum rate
+    const float _snr;
+
+    size_t _num_candidates{0};
+    size_t _num_radios{0};
+    //! Channel of each candidate, then its part orthogonal to the selected users
+    std::vector<sklk_mii_cf_t> _residuals{};
+    std::vector<float> _channel_power{};
+    std::vector<float> _residual_power{};
+    std::vector<uint8_t> _available{};
+
+public:
+    ref_design_group_selector(ref_design_group_selection selection, float max_correlation, float snr_db);
+
+    [[nodiscard]] ref_design_group_selection selection() const { return _selection; }
+
+    void reset(size_t num_candidates, size_t num_radios);
+
+    //! @return the num_radios values of the candidate's channel to fill
+    [[nodiscard]] sklk_mii_cf_t *channel(size_t candidate) { return _residuals.data() + candidate*_num_radios; }
+
+    /**
+     * Select the group.  Random selection does not need the channels.
+     * @param selected indices of the selected candidates, in the order they were selected
+     */
+    void select(size_t max_users, std::mt19937 &randomizer, std::vector<size_t> &selected);
+
+private:
+    void _select_orthogonal(size_t max_users, std::vector<size_t> &selected);
+    //! Remove the projection onto the newly selected user from the residual of every available candidate
+    void _project_out(size_t selected);
+};
@@ -0,0 +1,158 @@
+#include "incremental_factor.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+
+ref_design_incremental_factor::ref_design_incremental_factor(size_t max_users) :
+    _max_users(max_users),
+    _keys(max_users),
+    _csi_versions(max_users),
+    _factor(max_users*max_users),
+    _work(max_users*max_users),
+    _column(max_users)
+{
+}
+
+void ref_design_incremental_factor::assign(const size_t *keys, const uint64_t *csi_versions, size_t num_users,
+                                           uint64_t inputs_version, const ref_design_zf_batch &batch, size_t problem)
+{
+    if (num_users > _max_users or batch.factor_stride() > _max_users) {
+        _valid = false;
+        return;
+    }
+
+    const std::complex<double> *factor = batch.factor(problem);
+    for (size_t row = 0; row < num_users; row++)
+        std::copy_n(factor + row*batch.factor_stride(), row + 1, _factor.data() + row*_max_users);
+    std::copy_n(keys, num_users, _keys.data());
+    std::copy_n(csi_versions, num_users, _csi_versions.data());
+    _num_users = num_users;
+    _inputs_version = inputs_version;
+    _regularization = batch.regularization(problem);
+    _valid = true;
+}
+
+bool ref_design_incremental_factor::update(const size_t *keys, const uint64_t *csi_versions, size_t num_users, uint64_t inputs_version,
+                                           ref_design_zf_batch &batch, size_t problem, const ref_design_complex_kernels &kernels, double drift_threshold)
+{
+    if (not _valid or inputs_version != _inputs_version or num_users > _max_users or batch.factor_stride() > _max_users)
+        return false;
+
+    // The remaining users must be a prefix of the new users, in their previous order, with unchanged CSI
+    size_t num_remaining{0};
+    for (size_t old_user = 0; old_user < _num_users; old_user++) {
+        const auto *end = keys + num_users;
+        const auto *found = std::find(keys, end, _keys[old_user]);
+        if (found == end)
+            continue;
+        if (static_cast<size_t>(found - keys) != num_remaining or csi_versions[num_remaining] != _csi_versions[old_user])
+            return false;
+        num_remaining++;
+    }
+    if (num_remaining == _num_users and num_remaining == num_users)
+        return false;
+
+    std::copy(_factor.begin(), _factor.end(), _work.begin());
+
+    // Remove the users that left, last first so the earlier rows keep their position
+    size_t size = _num_users;
+    for (size_t old_user = _num_users; old_user-- > 0;) {
+        if (std::find(keys, keys + num_remaining, _keys[old_user]) == keys + num_remaining) {
+            _remove(old_user, size);
+            size--;
+        }
+    }
+    assert(size == num_remaining);
+
+    // Append the users that joined
+    for (size_t user = num_remaining; user < num_users; user++) {
+        if (not _append(user, batch, problem, kernels))
+            return false;
+    }
+
+    // Check for drift on the diagonal, diag(L L^H) == |a_i|^2 + lambda
+    for (size_t user = 0; user < num_users; user++) {
+        float re{};
+        float im{};
+        kernels.dot_conj(batch.a_re(problem, user), batch.a_im(problem, user), batch.a_re(problem, user), batch.a_im(problem, user),
+                         batch.stride(), re, im);
+        const double expected = re + _regularization;
+        double actual{};
+        for (size_t col = 0; col <= user; col++)
+            actual += std::norm(_at(user, col));
+        if (not (std::abs(actual - expected) <= drift_threshold*expected))
+            return false;
+    }
+
+    std::copy(_work.begin(), _work.end(), _factor.begin());
+    std::copy_n(keys, num_users, _keys.data());
+    std::copy_n(csi_versions, num_users, _csi_versions.data());
+    _num_users = num_users;
+
+    std::complex<double> *factor = batch.factor(problem);
+    for (size_t row = 0; row < num_users; row++)
+        std::copy_n(_factor.data() + row*_max_users, row + 1, factor + row*batch.factor_stride());
+    batch.solve_factored(problem, kernels);
+    return batch.ok(problem);
+}
+
+void ref_design_incremental_factor::_remove(size_t user, size_t num_users)
+{
+    // Deleting row `user` leaves the rows below it with an extra column x = L[user + 1:, user].  Restore the
+    // triangle by applying L' L'^H = L L^H + x x^H to the trailing block with Givens rotations.
+    for (size_t row = user + 1; row < num_users; row++)
+        _column[row] = _at(row, user);
+
+    for (size_t j = user + 1; j < num_users; j++) {
+        const double a = _at(j, j).real();
+        const std::complex<double> b = _column[j];
+        const double r = std::sqrt(a*a + std::norm(b));
+        _at(j, j) = r;
+        for (size_t row = j + 1; row < num_users; row++) {
+            const std::complex<double> l = _at(row, j);
+            const std::complex<double> x = _column[row];
+            _at(row, j) = (a*l + std::conj(b)*x)/r;
+            _column[row] = (a*x - b*l)/r;
+        }
+    }
+
+    // Shift the rows and columns after the removed user up and left
+    for (size_t row = user; row + 1 < num_users; row++) {
+        for (size_t col = 0; col < user; col++)
+            _at(row, col) = _at(row + 1, col);
+        for (size_t col = user; col <= row; col++)
+            _at(row, col) = _at(row + 1, col + 1);
+    }
+}
+
+bool ref_design_incremental_factor::_append(size_t user, ref_design_zf_batch &batch, size_t problem, const ref_design_complex_kernels &kernels)
+{
+    // With g = A a^H, solve L m = g and the new row is [m^H, sqrt(|a|^2 + lambda - |m|^2)]
+    double power{};
+    for (size_t row = 0; row <= user; row++) {
+        float re{};
+        float im{};
+        kernels.dot_conj(batch.a_re(problem, row), batch.a_im(problem, row), batch.a_re(problem, user), batch.a_im(problem, user),
+                         batch.stride(), re, im);
+        if (row == user) {
+            power = re + _regularization;
+            break;
+        }
+
+        std::complex<double> sum{re, im};
+        for (size_t col = 0; col < row; col++)
+            sum -= _at(row, col)*_column[col];
+        _column[row] = sum/_at(row, row).real();
+    }
+
+    double pivot = power;
+    for (size_t col = 0; col < user; col++) {
+        pivot -= std::norm(_column[col]);
+        _at(user, col) = std::conj(_column[col]);
+    }
+    if (not (pivot > ref_design_min_pivot*power))
+        return false;
+    _at(user, user) = std::sqrt(pivot);
+    return true;
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include "api.hpp"
+#include "batched_kernels.hpp"
+
+#include <complex>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/**
+ * The Cholesky factor of A A^H + lambda I for one resource block, direction, and estimation, kept between weight
+ * calculations.
+ *
+ * When users join or leave a group and the CSI of the remaining users has not changed, the factor is updated
+ * with rank-one changes instead of being recalculated from the Gram matrix.  Removing a user deletes its row and
+ * re-triangularizes the rows below it.  Adding a user appends a row.  Lambda keeps the value from the last full
+ * factorization.
+ */
+class SKLK_PHY_MOD_REFDESIGN_API ref_design_incremental_factor
+{
+    size_t _max_users;
+    size_t _num_users{0};
+    bool _valid{false};
+    uint64_t _inputs_version{0};
+    double _regularization{0.0};
+    std::vector<size_t> _keys;
+    std::vector<uint64_t> _csi_versions;
+    std::vector<std::complex<double>> _factor;
+    std::vector<std::complex<double>> _work;
+    std::vector<std::complex<double>> _column;
+
+public:
+    explicit ref_design_incremental_factor(size_t max_users);
+
+    void invalidate() { _valid = false; }
+    [[nodiscard]] bool valid() const { return _valid; }
+    [[nodiscard]] size_t num_users() const { return _valid ? _num_users : 0; }
+    [[nodiscard]] const size_t *keys() const { return _keys.data(); }
+
+    /**
+     * Keep the factor of a full factorization.
+     * @param inputs_version changes whenever something other than the CSI of a user changes the channel matrix
+     */
+    void assign(const size_t *keys, const uint64_t *csi_versions, size_t num_users, uint64_t inputs_version,
+                const ref_design_zf_batch &batch, size_t problem);
+
+    /**
+     * Update the factor for a new set of users and copy it into the batch problem.
+     *
+     * The remaining users must keep their previous order and come before the new users.  The channel rows of
+     * the new set must already be loaded in the batch problem.
+     *
+     * @param drift_threshold largest relative error of the diagonal of L L^H accepted after the update
+     * @return false when a full factorization is required
+     */
+    bool update(const size_t *keys, const uint64_t *csi_versions, size_t num_users, uint64_t inputs_version,
+                ref_design_zf_batch &batch, size_t problem, const ref_design_complex_kernels &kernels, double drift_threshold);
+
+private:
+    [[nodiscard]] std::complex<double> &_at(size_t row, size_t col) { return _work[row*_max_users + col]; }
+    void _remove(size_t user, size_t num_users);
+    bool _append(size_t user, ref_design_zf_batch &batch, size_t problem, const ref_design_complex_kernels &kernels);
+};
@@ -2,8 +2,12 @@
 
 #include "rpc.hpp"
 #include "csi_mod.hpp"
+#include "csi_router.hpp"
 #include "schedule_mod.hpp"
 
+#include <sklk-mii/simple_log.hpp>
+
+#include <algorithm>
 #include <iostream>
 
 //! [Factory installed on module load]
@@ -23,39 +27,88 @@ std::shared_ptr<sklk_phy_mod_loader> ref_design_mod_loader_factory::create(
 
 //! [The loader creating the modules]
 ref_design_mod_loader::ref_design_mod_loader(const sklk_phy_scheduler_config & config) :
-    sklk_phy_mod_loader(config)
+    sklk_phy_mod_loader(config),
+    _num_resource_blks(config.num_bands),
+    mod_config(ref_design_config::from_environment())
 {
     rpc_hdl = std::make_shared<ref_design_rpc_handler>(this);
-    auto local_csi_mod = std::make_shared<ref_design_csi_mod>(this, config);
-    auto local_schedule_mod = std::make_shared<ref_design_schedule_mod>(this, config);
+    // Every shard owns at least one resource block
+    const size_t num_csi_shards = std::max<size_t>(1, std::min(mod_config.csi_shards, _num_resource_blks));
+    if (num_csi_shards != mod_config.csi_shards)
+        sklk_mii_log::warn("Using {} CSI shards for {} resource blocks", num_csi_shards, _num_resource_blks);
+    auto local_schedule_mod = std::make_shared<ref_design_schedule_mod>(this, config, mod_config);
 
     //! [Subscribing to message queues]
-    _msg_queues.enable_radio.subscribe(local_csi_mod);
-    _msg_queues.cc.subscribe(local_csi_mod);
+    // With several shards, the router receives the CSI and calibration and forwards each message to its shard
+    std::vector<std::shared_ptr<ref_design_csi_mod>> shards;
+    for (size_t shard_no = 0; shard_no < num_csi_shards; shard_no++) {
+        auto local_csi_mod = std::make_shared<ref_design_csi_mod>(this, config, mod_config, shard_no, num_csi_shards);
+        _msg_queues.enable_radio.subscribe(local_csi_mod);
+        if (num_csi_shards == 1) {
+            _msg_queues.cc.subscribe(local_csi_mod);
+
+            //! [Subscribing to the csi queue]
+            _msg_queues.csi.subscribe(local_csi_mod);
+            //! [Subscribing to the csi queue]
+        }
 
-    //! [Subscribing to the csi queue]
-    _msg_queues.csi.subscribe(local_csi_mod);
-    //! [Subscribing to the csi queue]
+        csi_mods.push_back(local_csi_mod);
+        shards.push_back(local_csi_mod);
+        this->add_module(std::move(local_csi_mod));
+    }
+    if (num_csi_shards > 1) {
+        auto local_csi_router = std::make_shared<ref_design_csi_router>(this, mod_config, _num_resource_blks, std::move(shards));
+        _msg_queues.cc.subscribe(local_csi_router);
+        _msg_queues.csi.subscribe(local_csi_router);
+        csi_router = local_csi_router;
+        this->add_module(std::move(local_csi_router));
+    }
 
     _msg_queues.schedule_request.subscribe(local_schedule_mod);
     //! [Subscribing to message queues]
 
-    csi_mod = local_csi_mod;
     scedule_mod = local_schedule_mod;
-    this->add_module(std::move(local_csi_mod));
     this->add_module(std::move(local_schedule_mod));
 }
 //! [The loader creating the modules]
 
 //! [Send the weights between modules]
-void ref_design_mod_loader::send_weight_page(size_t resource_blk_no, bool is_downlink, const sklk_phy_weight_page_id_t &page_hdl)
+void ref_design_mod_loader::send_weight_pages(
+    size_t frame_time, size_t resource_blk_no, bool is_downlink, const ref_design_weight_page_set &pages,
+    const ref_design_group_keys &keys)
+{
+    // The schedule module only uses the latest pages, so pages it has not taken yet are replaced
+    auto &buffer = _schedule_weight_pages.at(resource_blk_no)[is_downlink];
+    buffer.back() = {frame_time, pages, keys};
+    weight_page_stats.sent.fetch_add(1, std::memory_order_relaxed);
+    if (buffer.publish())
+        weight_page_stats.overwritten.fetch_add(1, std::memory_order_relaxed);
+    // Release the pages of the buffer swapped back, they were taken already or replaced
+    buffer.back().pages.fill(nullptr);
+}
+
+nlohmann::json ref_design_weight_page_stats::dump() const
 {
-    auto &queue = is_downlink ? _dl_schedule_weight_pages : _ul_schedule_weight_pages;
-    auto ok = queue.send_no_wake(resource_blk_no, page_hdl);
-    assert(ok);
+    return {
+        {"sent", sent.load(std::memory_order_relaxed)},
+        {"overwritten", overwritten.load(std::memory_order_relaxed)},
+        {"taken", taken.load(std::memory_order_relaxed)},
+        {"late", late.load(std::memory_order_relaxed)},
+        {"invalid", invalid.load(std::memory_order_relaxed)},
+    };
 }
 //! [Send the weights between modules]
 
+void ref_design_mod_loader::send_schedule_responses(size_t frame_time, uint8_t sfn, const ref_design_schedule_frame &frame)
+{
+    // The PHY only takes one response per resource block and direction, so this is the one place to switch over
+    // when it can take the whole frame
+    for (size_t resource_blk_no = 0; resource_blk_no < frame.num_resource_blks; resource_blk_no++) {
+        send_schedule_response(frame_time, sfn, resource_blk_no, true, *frame.dl_pages[resource_blk_no]);
+        send_schedule_response(frame_time, sfn, resource_blk_no, false, *frame.ul_pages[resource_blk_no]);
+    }
+}
+
 void ref_design_mod_loader::add_rpc_commands(jsonrpccxx::JsonRpc2Server &rpc_server [[maybe_unused]])
 {
     rpc_hdl->add_commands(rpc_server);
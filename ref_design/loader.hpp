@@ -1,48 +1,121 @@
 #pragma once
 
 #include "api.hpp"
+#include "config.hpp"
+#include "triple_buffer.hpp"
 
 #include <sklk-mii/message_queue.hpp>
 
 #include <sklkphy/common.hpp>
 #include <sklkphy/modding.hpp>
 
+#include <array>
+#include <atomic>
 #include <cstdint>
 #include <map>
 #include <memory>
+#include <vector>
 
 class ref_design_rpc_handler;
 class ref_design_csi_mod;
+class ref_design_csi_router;
 class ref_design_schedule_mod;
 
+//! The weight pages of the groups of one resource block and direction, nullptr for unused groups
+using ref_design_weight_page_set = std::array<sklk_phy_weight_page_id_t, ref_design_max_groups_per_block>;
+
+//! UE radio keys of the users of each group in page order, indexed like ref_design_weight_page_set
+struct ref_design_group_keys
+{
+    std::array<std::array<size_t, SKLK_PHY_MAX_MIMO_USERS>, ref_design_max_groups_per_block> keys{};
+    std::array<uint8_t, ref_design_max_groups_per_block> num_keys{};
+};
+
+//! The pages of one resource block and direction with the frame time of the CSI they were calculated from
+struct ref_design_weight_page_update
+{
+    size_t frame_time{0};
+    ref_design_weight_page_set pages{};
+    ref_design_group_keys keys{};
+};
+
+//! Counters of the weight page hand off between the CSI and schedule modules
+struct ref_design_weight_page_stats
+{
+    //! Written by the CSI module
+    std::atomic_size_t sent{0};
+    //! Sent pages replaced by newer pages before the schedule module took them
+    std::atomic_size_t overwritten{0};
+    //! Written by the schedule module
+    alignas(64) std::atomic_size_t taken{0};
+    //! Pages taken more than max_weight_page_delay_frames behind the latest schedule request
+    std::atomic_size_t late{0};
+    //! Pages no longer valid when the schedule module took them, these were delivered but not scheduled
+    std::atomic_size_t invalid{0};
+
+    [[nodiscard]] nlohmann::json dump() const;
+};
+
+//! The pages scheduled in one frame, indexed by resource block.  The pages are owned by the caller.
+struct ref_design_schedule_frame
+{
+    size_t num_resource_blks{0};
+    std::array<const sklk_phy_weight_page_id_t *, SKLK_PHY_MAX_BANDS> dl_pages{};
+    std::array<const sklk_phy_weight_page_id_t *, SKLK_PHY_MAX_BANDS> ul_pages{};
+};
+
 class SKLK_PHY_MOD_REFDESIGN_API ref_design_mod_loader : public sklk_phy_mod_loader {
-    static constexpr size_t _max_frame_delay{10};
+    const size_t _num_resource_blks;
 
     //! [weight page queue]
-    sklk_mii_message_queue<std::tuple<size_t, sklk_phy_weight_page_id_t>, _max_frame_delay*SKLK_PHY_MAX_BANDS> _dl_schedule_weight_pages;
-    sklk_mii_message_queue<std::tuple<size_t, sklk_phy_weight_page_id_t>, _max_frame_delay*SKLK_PHY_MAX_BANDS> _ul_schedule_weight_pages;
+    //! Latest weight pages of each resource block, indexed by [resource_blk_no][is_downlink]
+    std::array<std::array<ref_design_triple_buffer<ref_design_weight_page_update>, 2>, SKLK_PHY_MAX_BANDS> _schedule_weight_pages{};
     //! [weight page queue]
 
 public:
     explicit ref_design_mod_loader(const sklk_phy_scheduler_config & config);
     ~ref_design_mod_loader() override = default;
 
+    const ref_design_config mod_config;
+
     std::shared_ptr<ref_design_rpc_handler> rpc_hdl;
-    std::weak_ptr<ref_design_csi_mod> csi_mod;
+    //! CSI shards, in the order of the resource blocks they own
+    std::vector<std::weak_ptr<ref_design_csi_mod>> csi_mods;
+    //! Forwards CSI and calibration to the shards, empty with a single shard
+    std::weak_ptr<ref_design_csi_router> csi_router;
     std::weak_ptr<ref_design_schedule_mod> scedule_mod;
 
+    //! Frame time of the latest schedule request, published by the schedule module for the CSI module
+    std::atomic_size_t last_schedule_frame_time{0};
+    //! Frame time of the latest CSI of any block, published by the CSI router for the shards
+    std::atomic_size_t last_csi_frame_time{0};
+
+    ref_design_weight_page_stats weight_page_stats{};
+
     //! [send the weight page]
-    void send_weight_page(size_t resource_blk_no, bool is_downlink, const sklk_phy_weight_page_id_t &page_hdl);
+    void send_weight_pages(size_t frame_time, size_t resource_blk_no, bool is_downlink, const ref_design_weight_page_set &pages,
+                           const ref_design_group_keys &keys);
     //! [send the weight page]
 
+    //! Respond to a schedule request with the pages of every resource block and direction at once
+    void send_schedule_responses(size_t frame_time, uint8_t sfn, const ref_design_schedule_frame &frame);
+
     //! [receiving the weight]
     template<typename Callback>
     void get_weight_pages(bool is_downlink, Callback callback) {
-        auto &queue = is_downlink ? _dl_schedule_weight_pages : _ul_schedule_weight_pages;
-        std::tuple<size_t, sklk_phy_weight_page_id_t> msg;
-        while (queue.pop(msg)) {
-            const auto &[resource_blk_no, page_hdl] = msg;
-            callback(resource_blk_no, page_hdl);
+        for (size_t resource_blk_no = 0; resource_blk_no < _num_resource_blks; resource_blk_no++) {
+            auto &buffer = _schedule_weight_pages[resource_blk_no][is_downlink];
+            if (not buffer.update())
+                continue;
+
+            auto &update = buffer.front();
+            weight_page_stats.taken.fetch_add(1, std::memory_order_relaxed);
+            const size_t max_delay = mod_config.max_weight_page_delay_frames;
+            if (max_delay and last_schedule_frame_time.load(std::memory_order_relaxed) > update.frame_time + max_delay)
+                weight_page_stats.late.fetch_add(1, std::memory_order_relaxed);
+            callback(resource_blk_no, update.pages, update.keys);
+            // The callback keeps the pages it schedules, a handle left here would keep the page from being reused
+            update.pages.fill(nullptr);
         }
     }
     //! [receiving the weight]
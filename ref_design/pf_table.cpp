@@ -0,0 +1,121 @@
+#include "pf_table.hpp"
+
+#include <algorithm>
+#include <cassert>
+
+//! Smallest average rate used in the metric, so that a stream that was never served wins over any served one
+static constexpr float min_avg_rate{1e-6f};
+
+//! Decay below which the stored rates are multiplied out, long before they could overflow
+static constexpr double min_decay{1e-20};
+
+ref_design_pf_table::ref_design_pf_table(size_t capacity, float alpha) :
+    _alpha(alpha),
+    _scaled_rate(std::min<size_t>(capacity, invalid_index)),
+    _served(_scaled_rate.size()),
+    _in_use(_scaled_rate.size()),
+    _keys(_scaled_rate.size())
+{
+    assert(alpha >= 0.0f and alpha < 1.0f);
+    // At most half of the buckets are used, so probes stay short
+    size_t num_buckets{2};
+    while (num_buckets < 2*_scaled_rate.size()) {
+        num_buckets *= 2;
+        _bucket_shift--;
+    }
+    _buckets.assign(num_buckets, invalid_index);
+    _served_indices.reserve(_scaled_rate.size());
+    _free.reserve(_scaled_rate.size());
+    for (size_t index = _scaled_rate.size(); index-- > 0;)
+        _free.push_back(index);
+}
+
+uint16_t ref_design_pf_table::find(size_t key) const
+{
+    for (size_t bucket = _home(key); _buckets[bucket] != invalid_index; bucket = (bucket + 1) & _mask()) {
+        if (_keys[_buckets[bucket]] == key)
+            return _buckets[bucket];
+    }
+    return invalid_index;
+}
+
+uint16_t ref_design_pf_table::index(size_t key)
+{
+    size_t bucket = _home(key);
+    for (; _buckets[bucket] != invalid_index; bucket = (bucket + 1) & _mask()) {
+        if (_keys[_buckets[bucket]] == key)
+            return _buckets[bucket];
+    }
+    if (_free.empty())
+        return invalid_index;
+
+    const uint16_t index = _free.back();
+    _free.pop_back();
+    _scaled_rate[index] = 0.0;
+    _served[index] = 0.0f;
+    _in_use[index] = 1;
+    _keys[index] = key;
+    _buckets[bucket] = index;
+    return index;
+}
+
+void ref_design_pf_table::release(uint16_t index)
+{
+    if (index == invalid_index or not _in_use[index])
+        return;
+    _in_use[index] = 0;
+    _free.push_back(index);
+
+    size_t hole = _home(_keys[index]);
+    while (_buckets[hole] != index)
+        hole = (hole + 1) & _mask();
+    // Move later entries of the probe sequence back so that no probe stops at the hole
+    for (size_t bucket = (hole + 1) & _mask(); _buckets[bucket] != invalid_index; bucket = (bucket + 1) & _mask()) {
+        const size_t home = _home(_keys[_buckets[bucket]]);
+        const bool stays = hole < bucket ? hole < home and home <= bucket : hole < home or home <= bucket;
+        if (stays)
+            continue;
+        _buckets[hole] = _buckets[bucket];
+        hole = bucket;
+    }
+    _buckets[hole] = invalid_index;
+}
+
+float ref_design_pf_table::metric(const uint16_t *indices, size_t num_indices) const
+{
+    float metric{};
+    for (size_t i = 0; i < num_indices; i++) {
+        if (indices[i] != invalid_index)
+            metric += 1.0f/std::max(avg_rate(indices[i]), min_avg_rate);
+    }
+    return metric;
+}
+
+void ref_design_pf_table::serve(const uint16_t *indices, size_t num_indices)
+{
+    for (size_t i = 0; i < num_indices; i++) {
+        if (indices[i] == invalid_index)
+            continue;
+        if (_served[indices[i]] == 0.0f)
+            _served_indices.push_back(indices[i]);
+        _served[indices[i]] += 1.0f;
+    }
+}
+
+void ref_design_pf_table::update(size_t num_blocks)
+{
+    if (_decay < min_decay) {
+        for (size_t index = 0; index < _scaled_rate.size(); index++)
+            _scaled_rate[index] *= _decay;
+        _decay = 1.0;
+    }
+
+    // avg = (1 - alpha)*avg + alpha*served, the decay of every entry is folded into _decay
+    _decay *= 1.0 - _alpha;
+    const double scale = _alpha/(_decay*std::max<size_t>(num_blocks, 1));
+    for (uint16_t index : _served_indices) {
+        _scaled_rate[index] += _served[index]*scale;
+        _served[index] = 0.0f;
+    }
+    _served_indices.clear();
+}
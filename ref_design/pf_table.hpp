@@ -0,0 +1,69 @@
+#pragma once
+
+#include "api.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/**
+ * Exponentially averaged served rate of every scheduled stream, for proportional-fair scheduling.
+ *
+ * Streams are looked up by UE radio key in an open addressing table sized with the entries, so neither adding nor
+ * finding a stream allocates.  Scheduling a request only touches the flat per-entry arrays through the indices
+ * found when the pages arrived.  The averages are stored divided by the decay of all unserved entries since the
+ * last renormalization, so update() only touches the entries served since the last one.
+ * Rates are in streams served per resource block and request, since the scheduler does not see the MCS.
+ */
+class SKLK_PHY_MOD_REFDESIGN_API ref_design_pf_table
+{
+public:
+    static constexpr uint16_t invalid_index{UINT16_MAX};
+
+private:
+    //! Weight of the latest request in the average
+    const float _alpha;
+    //! Product of (1 - alpha) over the updates since the last renormalization
+    double _decay{1.0};
+    //! Average rates divided by _decay
+    std::vector<double> _scaled_rate;
+    //! Resource blocks each entry was served in since the last update()
+    std::vector<float> _served;
+    std::vector<uint16_t> _served_indices{};
+    std::vector<uint8_t> _in_use;
+    std::vector<size_t> _keys;
+    //! Entry of each bucket, invalid_index for empty buckets, probed linearly from the hash of the key
+    std::vector<uint16_t> _buckets{};
+    unsigned _bucket_shift{63};
+    std::vector<uint16_t> _free{};
+
+public:
+    //! @param alpha from 0 to less than 1
+    ref_design_pf_table(size_t capacity, float alpha);
+
+    [[nodiscard]] size_t capacity() const { return _scaled_rate.size(); }
+
+    //! Find or add the entry of a stream, invalid_index when the table is full
+    [[nodiscard]] uint16_t index(size_t key);
+
+    //! Find the entry of a stream without adding it, invalid_index when the stream has none
+    [[nodiscard]] uint16_t find(size_t key) const;
+
+    //! Free an entry once no group refers to it, freeing a free entry does nothing
+    void release(uint16_t index);
+
+    //! Sum of 1/average rate of the streams, the proportional-fair metric of serving them together
+    [[nodiscard]] float metric(const uint16_t *indices, size_t num_indices) const;
+
+    //! Account one resource block of service to each stream
+    void serve(const uint16_t *indices, size_t num_indices);
+
+    //! Fold the service of one schedule request over num_blocks resource blocks into the averages
+    void update(size_t num_blocks);
+
+    [[nodiscard]] float avg_rate(uint16_t index) const { return float(_scaled_rate[index]*_decay); }
+
+private:
+    [[nodiscard]] size_t _home(size_t key) const { return (key*0x9e3779b97f4a7c15ull) >> _bucket_shift; }
+    [[nodiscard]] size_t _mask() const { return _buckets.size() - 1; }
+};
@@ -1,4 +1,6 @@
 #include "rpc.hpp"
+#include "csi_mod.hpp"
+#include "csi_router.hpp"
 #include "loader.hpp"
 #include "schedule_mod.hpp"
 
@@ -16,6 +18,10 @@ void ref_design_rpc_handler::add_commands(jsonrpccxx::JsonRpc2Server &rpc_server
     std::weak_ptr<ref_design_rpc_handler> wptr = _loader->rpc_hdl;
 
     rpc_server.ForceAdd("get_group_summary", "", sklk_mii_safe_callback(&ref_design_rpc_handler::_rpc_get_group_summary, wptr), NamedParamMapping{"resource_blk_no"});
+    rpc_server.ForceAdd("get_mod_config", "", sklk_mii_safe_callback(&ref_design_rpc_handler::_rpc_get_config, wptr));
+    rpc_server.ForceAdd("get_csi_stats", "", sklk_mii_safe_callback(&ref_design_rpc_handler::_rpc_get_csi_stats, wptr));
+    rpc_server.ForceAdd("get_weight_page_stats", "", sklk_mii_safe_callback(&ref_design_rpc_handler::_rpc_get_weight_page_stats, wptr));
+    rpc_server.ForceAdd("get_thread_placement", "", sklk_mii_safe_callback(&ref_design_rpc_handler::_rpc_get_thread_placement, wptr));
 }
 
 void ref_design_rpc_handler::get_updates()
@@ -40,3 +46,53 @@ nlohmann::json ref_design_rpc_handler::_rpc_get_group_summary(ssize_t resource_b
 
     return j;
 }
+
+nlohmann::json ref_design_rpc_handler::_rpc_get_config()
+{
+    return _loader->mod_config;
+}
+
+nlohmann::json ref_design_rpc_handler::_rpc_get_csi_stats()
+{
+    // Counters are summed over the shards, which are also listed separately
+    auto j = nlohmann::json::object();
+    auto shards = nlohmann::json::array();
+    for (const auto &weak_csi_mod : _loader->csi_mods) {
+        auto csi_mod = weak_csi_mod.lock();
+        if (not csi_mod)
+            continue;
+        auto stats = csi_mod->dump_stats();
+        for (const auto &[name, value] : stats.items()) {
+            if (value.is_number_unsigned())
+                j[name] = j.value(name, size_t{0}) + value.get<size_t>();
+        }
+        stats["name"] = csi_mod->get_name();
+        shards.push_back(std::move(stats));
+    }
+    // Rates are taken over the summed counters
+    const size_t cache_lookups = j.value("weight_cache_hits", size_t{0}) + j.value("weight_cache_misses", size_t{0});
+    j["weight_cache_hit_rate"] = cache_lookups ? j.value("weight_cache_hits", size_t{0})/double(cache_lookups) : 0.0;
+    j["shards"] = std::move(shards);
+    if (auto csi_router = _loader->csi_router.lock())
+        j["router"] = csi_router->dump_stats();
+    return j;
+}
+
+nlohmann::json ref_design_rpc_handler::_rpc_get_weight_page_stats()
+{
+    return _loader->weight_page_stats.dump();
+}
+
+nlohmann::json ref_design_rpc_handler::_rpc_get_thread_placement()
+{
+    auto j = nlohmann::json::object();
+    for (const auto &weak_csi_mod : _loader->csi_mods) {
+        if (auto csi_mod = weak_csi_mod.lock())
+            j[csi_mod->get_name()] = csi_mod->dump_thread_placement();
+    }
+    if (auto csi_router = _loader->csi_router.lock())
+        j[csi_router->get_name()] = csi_router->dump_thread_placement();
+    if (auto schedule_mod = _loader->scedule_mod.lock())
+        j[schedule_mod->get_name()] = schedule_mod->dump_thread_placement();
+    return j;
+}
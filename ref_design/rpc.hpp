@@ -19,4 +19,8 @@ public:
 
 private:
     [[nodiscard]] nlohmann::json _rpc_get_group_summary(ssize_t resource_blk_no);
+    [[nodiscard]] nlohmann::json _rpc_get_config();
+    [[nodiscard]] nlohmann::json _rpc_get_csi_stats();
+    [[nodiscard]] nlohmann::json _rpc_get_weight_page_stats();
+    [[nodiscard]] nlohmann::json _rpc_get_thread_placement();
 };
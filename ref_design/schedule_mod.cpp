@@ -1,46 +1,114 @@
 #include "schedule_mod.hpp"
 
+#include "csi_mod.hpp"
 #include "loader.hpp"
 
 #include <sklk-mii/simple_log.hpp>
 
 const std::string ref_design_schedule_mod_name{"scheduling"};
 
+//! Schedule requests between snapshots of the averaged rates
+static constexpr size_t grant_snapshot_interval{64};
+
 class sklk_phy_mod_loader_template;
 
-ref_design_schedule_mod::ref_design_schedule_mod(ref_design_mod_loader *loader,  const mimo_rrh_scheduler_config &config) :
+ref_design_schedule_mod::ref_design_schedule_mod(
+    ref_design_mod_loader *loader,  const mimo_rrh_scheduler_config &config, const ref_design_config &mod_config) :
     sklk_phy_modding(ref_design_schedule_mod_name),
+    _thread_policy(mod_config.schedule_thread),
     _loader(loader),
     _num_resouce_blks(config.num_bands),
-    _dl_pages(_num_resouce_blks, nullptr),
-    _ul_pages(_num_resouce_blks, nullptr)
+    _weighted_rotation(mod_config.group_rotation == "weighted"),
+    _proportional_fair(mod_config.group_rotation == "proportional_fair"),
+    _dl_pages(_num_resouce_blks),
+    _ul_pages(_num_resouce_blks),
+    _dl_pf_table(mod_config.max_csi_ue_radios, mod_config.pf_alpha),
+    _ul_pf_table(mod_config.max_csi_ue_radios, mod_config.pf_alpha),
+    _dl_stream_blocks(_dl_pf_table.capacity()),
+    _ul_stream_blocks(_ul_pf_table.capacity()),
+    _rate_snapshots(ref_design_rate_snapshot{0, std::vector<float>(_dl_pf_table.capacity()),
+                                             std::vector<float>(_ul_pf_table.capacity())})
+{
+}
+
+size_t ref_design_group_rotation::assign(
+    const ref_design_weight_page_set &new_pages, const ref_design_group_keys &new_keys, bool weighted, ref_design_pf_table &pf_table)
+{
+    std::array<size_t, ref_design_max_groups_per_block> weights{};
+    size_t total_weight{0};
+    size_t num_dropped{0};
+    for (size_t group_no = 0; group_no < pages.size(); group_no++) {
+        const bool is_valid = sklk_phy_mod_page_access::page_is_valid(new_pages[group_no]);
+        if (new_pages[group_no] != nullptr and not is_valid)
+            num_dropped++;
+        pages[group_no] = is_valid ? new_pages[group_no] : nullptr;
+        num_streams[group_no] = 0;
+        keys.num_keys[group_no] = 0;
+        if (pages[group_no] == nullptr)
+            continue;
+
+        keys.keys[group_no] = new_keys.keys[group_no];
+        keys.num_keys[group_no] = new_keys.num_keys[group_no];
+        for (size_t i = 0; i < keys.num_keys[group_no]; i++)
+            streams[group_no][num_streams[group_no]++] = pf_table.index(keys.keys[group_no][i]);
+        weights[group_no] = weighted ? num_streams[group_no] : 1;
+        total_weight += weights[group_no];
+    }
+
+    // Smooth weighted round-robin spreads the slots of each group evenly over the rotation
+    std::array<ssize_t, ref_design_max_groups_per_block> current{};
+    num_slots = std::min(total_weight, slots.size());
+    for (size_t slot = 0; slot < num_slots; slot++) {
+        size_t best{0};
+        for (size_t group_no = 0; group_no < pages.size(); group_no++) {
+            current[group_no] += weights[group_no];
+            if (current[group_no] > current[best])
+                best = group_no;
+        }
+        current[best] -= total_weight;
+        slots[slot] = best;
+    }
+    return num_dropped;
+}
+
+size_t ref_design_group_rotation::select(const ref_design_pf_table &pf_table) const
 {
+    size_t best{0};
+    float best_metric{-1.0f};
+    for (size_t group_no = 0; group_no < pages.size(); group_no++) {
+        if (pages[group_no] == nullptr)
+            continue;
+        const float metric = pf_table.metric(streams[group_no].data(), num_streams[group_no]);
+        if (metric > best_metric) {
+            best = group_no;
+            best_metric = metric;
+        }
+    }
+    return best;
 }
 
 bool ref_design_schedule_mod::run_once()
 {
     bool run_again{false};
 
-    if (not _initialized) {
-        if (sklk_mii_set_thread_priority(0.7) < 0)
-        {
-            sklk_mii_log::warn("Could not set elevated thread priority");
-        }
-        _initialized = true;
+    if (not _initialized.load(std::memory_order_relaxed)) {
+        _thread_placement = ref_design_apply_thread_policy(get_name(), _thread_policy, 0.7);
+        _initialized.store(true, std::memory_order_release);
     }
 
     //! [get the weight page]
-    _loader->get_weight_pages(true, [&](size_t resouce_blk_no, const sklk_phy_weight_page_id_t &page_hdl) {
-        if (sklk_phy_mod_page_access::page_is_valid(page_hdl))
-            _dl_pages[resouce_blk_no] = page_hdl;
+    size_t num_invalid{0};
+    _loader->get_weight_pages(true, [&](size_t resouce_blk_no, const ref_design_weight_page_set &pages, const ref_design_group_keys &keys) {
+        num_invalid += _assign_pages(resouce_blk_no, true, pages, keys);
         run_again = true;
     });
-    _loader->get_weight_pages(false, [&](size_t resouce_blk_no, const sklk_phy_weight_page_id_t &page_hdl) {
-        if (sklk_phy_mod_page_access::page_is_valid(page_hdl))
-            _ul_pages[resouce_blk_no] = page_hdl;
+    _loader->get_weight_pages(false, [&](size_t resouce_blk_no, const ref_design_weight_page_set &pages, const ref_design_group_keys &keys) {
+        num_invalid += _assign_pages(resouce_blk_no, false, pages, keys);
         run_again = true;
     });
     //! [get the weight page]
+    if (num_invalid)
+        _loader->weight_page_stats.invalid.fetch_add(num_invalid, std::memory_order_relaxed);
 
     //! [get schedule request]
     sklk_phy_mod_schedule_request_msg_t msg{};
@@ -48,12 +116,11 @@ bool ref_design_schedule_mod::run_once()
     {
         const auto &[frame_time, sfn] = msg;
         schedule_update(frame_time, sfn);
+        if (++_requests_since_snapshot >= grant_snapshot_interval)
+            _publish_rates();
     }
     //! [get schedule request]
 
-    if (_handle_grant_stats())
-        run_again = true;
-
     return run_again;
 }
 
@@ -65,82 +132,190 @@ void ref_design_schedule_mod::ue_changed(size_t key, const sklk_phy_ue &ue [[may
 void ref_design_schedule_mod::ue_radio_changed(size_t key, const sklk_phy_ue_radio &ue_radio [[maybe_unused]], bool is_new)
 {
     sklk_mii_log::info("{}: UE radio update {} is_new={}", get_name(), key, is_new);
-
+    if (not is_new)
+        _recheck_pages(key);
 }
-void ref_design_schedule_mod::ue_stream_changed(size_t key, const sklk_phy_ue_stream &ue_stream [[maybe_unused]], bool is_new)
+void ref_design_schedule_mod::ue_stream_changed(size_t key, const sklk_phy_ue_stream &ue_stream, bool is_new)
 {
     sklk_mii_log::info("{}: UE stream update {} is_new={}", get_name(), key, is_new);
-    if (not is_new) {
-        // There has been a modification.  Check all pages
-        for (size_t resouce_blk_no = 0; resouce_blk_no < _num_resouce_blks; resouce_blk_no++) {
-            if (not sklk_phy_mod_page_access::page_is_valid(_ul_pages[resouce_blk_no]))
-                _ul_pages[resouce_blk_no] = nullptr;
-            if (not sklk_phy_mod_page_access::page_is_valid(_dl_pages[resouce_blk_no]))
-                _dl_pages[resouce_blk_no] = nullptr;
-        }
+    if (is_new)
+        return;
+    // Groups and proportional-fair entries are keyed by UE radio, not by stream
+    const size_t ue_radio_key = ref_design_ue_radio_key(ue_stream);
+    if (ue_radio_key == ref_design_csi_radio_container::invalid_key)
+        _recheck_all_pages();
+    else
+        _recheck_pages(ue_radio_key);
+}
+
+void ref_design_schedule_mod::_recheck_all_pages()
+{
+    for (bool is_downlink : {false, true})
+        _recheck_blocks(is_downlink, std::bitset<SKLK_PHY_MAX_BANDS>().set());
+}
+
+void ref_design_schedule_mod::_recheck_pages(size_t key)
+{
+    // There has been a modification.  Recheck only the pages of blocks grouping the UE radio.
+    for (bool is_downlink : {false, true}) {
+        const uint16_t index = (is_downlink ? _dl_pf_table : _ul_pf_table).find(key);
+        if (index != ref_design_pf_table::invalid_index)
+            _recheck_blocks(is_downlink, (is_downlink ? _dl_stream_blocks : _ul_stream_blocks)[index]);
+        else if (_untracked_streams[is_downlink])
+            // The UE radio may be grouped without an entry, when the table was full
+            _recheck_blocks(is_downlink, std::bitset<SKLK_PHY_MAX_BANDS>().set());
+    }
+}
+
+void ref_design_schedule_mod::_recheck_blocks(bool is_downlink, std::bitset<SKLK_PHY_MAX_BANDS> blocks)
+{
+    for (size_t resouce_blk_no = 0; resouce_blk_no < _num_resouce_blks; resouce_blk_no++) {
+        if (not blocks.test(resouce_blk_no))
+            continue;
+        // Copies, the rotation is rebuilt from them
+        const auto &rotation = (is_downlink ? _dl_pages : _ul_pages)[resouce_blk_no];
+        const auto pages = rotation.pages;
+        const auto keys = rotation.keys;
+        _assign_pages(resouce_blk_no, is_downlink, pages, keys);
     }
 }
 
 //! [respond to schedule request]
 void ref_design_schedule_mod::schedule_update(size_t frame_time [[maybe_unused]], uint8_t sfn [[maybe_unused]])
 {
+    _loader->last_schedule_frame_time.store(frame_time, std::memory_order_relaxed);
+    _schedule_frame.num_resource_blks = _num_resouce_blks;
     for (size_t resouce_blk_no = 0; resouce_blk_no < _num_resouce_blks; resouce_blk_no++) {
-        _loader->send_schedule_response(frame_time, sfn, resouce_blk_no, true, _dl_pages[resouce_blk_no]);
-        _loader->send_schedule_response(frame_time, sfn, resouce_blk_no, false, _ul_pages[resouce_blk_no]);
+        const auto &dl = _dl_pages[resouce_blk_no];
+        const auto &ul = _ul_pages[resouce_blk_no];
+        _schedule_frame.dl_pages[resouce_blk_no] = &dl.pages[_schedule_group(dl, _dl_pf_table, frame_time)];
+        _schedule_frame.ul_pages[resouce_blk_no] = &ul.pages[_schedule_group(ul, _ul_pf_table, frame_time)];
     }
+    _loader->send_schedule_responses(frame_time, sfn, _schedule_frame);
+    _dl_pf_table.update(_num_resouce_blks);
+    _ul_pf_table.update(_num_resouce_blks);
 }
 //! [respond to schedule request]
 
-nlohmann::json ref_design_schedule_mod::dump_grants(size_t req_resource_blk_no, bool is_downlink)
+size_t ref_design_schedule_mod::_schedule_group(const ref_design_group_rotation &rotation, ref_design_pf_table &pf_table, size_t frame_time)
 {
-    std::lock_guard guard(_grant_stats_lock);
-    size_t request_id = _grant_stats_request_id;
-    _grant_stats_request_queue.send_no_wake(request_id, req_resource_blk_no, is_downlink);
-    nlohmann::json j = nlohmann::json::array();
-
-    std::tuple<size_t, ssize_t, mimo_weight_page_id_t> msg{};
-    const auto &[response_id, resource_blk_no, page_hdl] = msg;
-    while (_grant_stats_response_queue.pop(msg, 1000)) {
-        if (response_id < request_id)
-            continue;
-        assert(response_id == request_id);
-        if (page_hdl == nullptr)
-            break;
-
-        auto entry = sklk_phy_mod_page_access::dump_group(page_hdl);
-        entry["xfer"] = is_downlink ? "downlink" : "uplink";
-        entry["resource_blk_no"] = resource_blk_no;
-        j.push_back(entry);
-    }
-    return j;
+    const size_t group_no = _proportional_fair ? rotation.select(pf_table) : rotation.select(frame_time);
+    if (rotation.pages[group_no] != nullptr)
+        pf_table.serve(rotation.streams[group_no].data(), rotation.num_streams[group_no]);
+    return group_no;
 }
 
-bool ref_design_schedule_mod::_handle_grant_stats()
+size_t ref_design_schedule_mod::_assign_pages(
+    size_t resource_blk_no, bool is_downlink, const ref_design_weight_page_set &pages, const ref_design_group_keys &keys)
 {
-    std::tuple<size_t, ssize_t, bool> msg{};
-    const auto &[request_id, req_resource_blk_no, is_downlink] = msg;
-    if (_grant_stats_request_queue.pop(msg)) {
-        if (req_resource_blk_no >= 0) {
-            _send_grant_stats(request_id, req_resource_blk_no, is_downlink);
-        } else {
-            for(size_t resource_blk_no = 0; resource_blk_no < _num_resouce_blks; ++resource_blk_no) {
-                _send_grant_stats(request_id, resource_blk_no, is_downlink);
+    auto &rotation = (is_downlink ? _dl_pages : _ul_pages)[resource_blk_no];
+    auto &pf_table = is_downlink ? _dl_pf_table : _ul_pf_table;
+    auto &stream_blocks = is_downlink ? _dl_stream_blocks : _ul_stream_blocks;
+
+    std::array<uint16_t, ref_design_max_groups_per_block*SKLK_PHY_MAX_MIMO_USERS> old_streams{};
+    size_t num_old_streams{0};
+    auto &untracked_streams = _untracked_streams[is_downlink];
+    for (size_t group_no = 0; group_no < rotation.pages.size(); group_no++) {
+        for (size_t i = 0; i < rotation.num_streams[group_no]; i++) {
+            const uint16_t index = rotation.streams[group_no][i];
+            if (index == ref_design_pf_table::invalid_index) {
+                untracked_streams--;
+                continue;
             }
+            old_streams[num_old_streams++] = index;
+            stream_blocks[index].reset(resource_blk_no);
         }
+    }
+
+    const size_t num_dropped = rotation.assign(pages, keys, _weighted_rotation, pf_table);
+    for (size_t group_no = 0; group_no < rotation.pages.size(); group_no++) {
+        for (size_t i = 0; i < rotation.num_streams[group_no]; i++) {
+            const uint16_t index = rotation.streams[group_no][i];
+            if (index != ref_design_pf_table::invalid_index)
+                stream_blocks[index].set(resource_blk_no);
+            else
+                untracked_streams++;
+        }
+    }
 
-        auto ok = _grant_stats_response_queue.send(request_id, -1, nullptr);
-        assert(ok);
-        return true;
+    // Free the entries of streams that are no longer in any group
+    for (size_t i = 0; i < num_old_streams; i++) {
+        if (stream_blocks[old_streams[i]].none())
+            pf_table.release(old_streams[i]);
     }
-    return false;
+    _publish_rotation(resource_blk_no, is_downlink);
+    return num_dropped;
+}
+
+void ref_design_schedule_mod::_publish_rotation(size_t resource_blk_no, bool is_downlink)
+{
+    // A snapshot is a few fixed arrays, so this copies one block's groups and does not allocate
+    const auto &rotation = (is_downlink ? _dl_pages : _ul_pages)[resource_blk_no];
+    auto &snapshot = _rotation_snapshots[resource_blk_no][is_downlink].back();
+    snapshot.version = ++_snapshot_version;
+    std::copy(rotation.pages.begin(), rotation.pages.end(), snapshot.pages.begin());
+    snapshot.streams = rotation.streams;
+    snapshot.num_streams = rotation.num_streams;
+    _rotation_snapshots[resource_blk_no][is_downlink].publish();
 }
 
-void ref_design_schedule_mod::_send_grant_stats(size_t request_id, size_t resource_blk_no, bool is_downlink)
+void ref_design_schedule_mod::_publish_rates()
 {
-    const auto &pages = is_downlink ? _dl_pages : _ul_pages;
-    auto &page = pages[resource_blk_no];
-    if (page) {
-        auto ok = _grant_stats_response_queue.send(request_id, resource_blk_no, page);
-        assert(ok);
+    // Every buffer was sized in the constructor, so the copies below do not allocate
+    auto &snapshot = _rate_snapshots.back();
+    snapshot.version = ++_snapshot_version;
+    for (size_t index = 0; index < snapshot.dl_avg_rate.size(); index++)
+        snapshot.dl_avg_rate[index] = _dl_pf_table.avg_rate(index);
+    for (size_t index = 0; index < snapshot.ul_avg_rate.size(); index++)
+        snapshot.ul_avg_rate[index] = _ul_pf_table.avg_rate(index);
+    _rate_snapshots.publish();
+    _requests_since_snapshot = 0;
+}
+
+nlohmann::json ref_design_schedule_mod::dump_grants(ssize_t req_resource_blk_no, bool is_downlink)
+{
+    std::lock_guard guard(_grant_snapshot_lock);
+    _rate_snapshots.update();
+    const auto &rates = _rate_snapshots.front();
+    const auto &avg_rate = is_downlink ? rates.dl_avg_rate : rates.ul_avg_rate;
+
+    nlohmann::json j = nlohmann::json::array();
+    for (size_t resource_blk_no = 0; resource_blk_no < _num_resouce_blks; resource_blk_no++) {
+        if (req_resource_blk_no >= 0 and size_t(req_resource_blk_no) != resource_blk_no)
+            continue;
+
+        auto &buffer = _rotation_snapshots[resource_blk_no][is_downlink];
+        buffer.update();
+        const auto &snapshot = buffer.front();
+        for (size_t group_no = 0; group_no < snapshot.pages.size(); group_no++) {
+            // Pages released since the snapshot are no longer scheduled
+            const sklk_phy_weight_page_id_t page = snapshot.pages[group_no].lock();
+            if (not page)
+                continue;
+
+            // The streams were indexed in page order when the schedule thread took the page
+            nlohmann::json pf_state = nlohmann::json::array();
+            const auto ue_streams = sklk_phy_mod_page_access::get_ue_streams(page);
+            for (size_t i = 0; i < snapshot.num_streams[group_no] and i < ue_streams.size(); i++) {
+                const uint16_t index = snapshot.streams[group_no][i];
+                if (index != ref_design_pf_table::invalid_index)
+                    pf_state.push_back({{"stream", sklk_phy_mod_ue_access::get_identifier(ue_streams[i])}, {"avg_rate", avg_rate[index]}});
+            }
+
+            auto entry = sklk_phy_mod_page_access::dump_group(page);
+            entry["xfer"] = is_downlink ? "downlink" : "uplink";
+            entry["resource_blk_no"] = resource_blk_no;
+            entry["proportional_fair"] = std::move(pf_state);
+            entry["snapshot_version"] = snapshot.version;
+            j.push_back(entry);
+        }
     }
+    return j;
+}
+
+nlohmann::json ref_design_schedule_mod::dump_thread_placement() const
+{
+    if (not _initialized.load(std::memory_order_acquire))
+        return nullptr;
+    return _thread_placement;
 }
@@ -1,32 +1,104 @@
 #pragma once
 
 #include "api.hpp"
+#include "config.hpp"
+#include "loader.hpp"
+#include "pf_table.hpp"
+#include "triple_buffer.hpp"
 
 #include <sklkphy/modding.hpp>
 #include <sklkphy/mimo_rrh_scheduler.hpp>
 #include <sklkphy/common.hpp>
 
+#include <bitset>
+
 extern const std::string ref_design_schedule_mod_name;
-class ref_design_mod_loader;
+
+//! The groups of one resource block and direction, and the order they are scheduled in
+struct SKLK_PHY_MOD_REFDESIGN_API ref_design_group_rotation
+{
+    ref_design_weight_page_set pages{};
+    //! UE radio keys of the streams of each group, the proportional-fair entries are keyed by them
+    ref_design_group_keys keys{};
+    //! Proportional-fair table entries of the streams of each group
+    std::array<std::array<uint16_t, SKLK_PHY_MAX_MIMO_USERS>, ref_design_max_groups_per_block> streams{};
+    std::array<uint8_t, ref_design_max_groups_per_block> num_streams{};
+    //! Group numbers in the order they are scheduled, indexed by frame time modulo num_slots
+    std::array<uint8_t, ref_design_max_groups_per_block*SKLK_PHY_MAX_MIMO_USERS> slots{};
+    size_t num_slots{0};
+
+    //! Take the new pages, dropping invalid ones, and rebuild the rotation.  Weighted rotation serves each group
+    //! in proportion to its number of streams, otherwise every group is served equally.
+    //! @return the number of invalid pages dropped
+    size_t assign(const ref_design_weight_page_set &new_pages, const ref_design_group_keys &new_keys, bool weighted,
+                  ref_design_pf_table &pf_table);
+
+    //! @return the group to schedule for the frame.  The 8 bit SFN would repeat a group when it wraps and
+    //! num_slots does not divide 256, the frame time counts on.
+    [[nodiscard]] size_t select(size_t frame_time) const
+    {
+        return num_slots ? slots[frame_time%num_slots] : 0;
+    }
+
+    //! @return the group with the largest proportional-fair metric
+    [[nodiscard]] size_t select(const ref_design_pf_table &pf_table) const;
+};
+
+//! Copy of the groups of one block and direction published for monitoring, so readers never wait on the schedule thread
+struct SKLK_PHY_MOD_REFDESIGN_API ref_design_rotation_snapshot
+{
+    //! Snapshot version of the schedule module when the rotation was published
+    uint64_t version{0};
+    //! Weak, so a page is not kept from reuse by the CSI module until the next reader takes the snapshot
+    std::array<std::weak_ptr<sklk_phy_weight_page_id_t::element_type>, ref_design_max_groups_per_block> pages{};
+    std::array<std::array<uint16_t, SKLK_PHY_MAX_MIMO_USERS>, ref_design_max_groups_per_block> streams{};
+    std::array<uint8_t, ref_design_max_groups_per_block> num_streams{};
+};
+
+//! Copy of the averaged rates published for monitoring, indexed like the proportional-fair tables
+struct SKLK_PHY_MOD_REFDESIGN_API ref_design_rate_snapshot
+{
+    uint64_t version{0};
+    std::vector<float> dl_avg_rate{};
+    std::vector<float> ul_avg_rate{};
+};
 
 class SKLK_PHY_MOD_REFDESIGN_API ref_design_schedule_mod : public sklk_phy_modding
 {
-    bool _initialized{false};
+    //! Set once the thread policy was applied on the module thread, _thread_placement is constant after
+    std::atomic_bool _initialized{false};
+    const ref_design_thread_policy _thread_policy;
+    ref_design_thread_placement _thread_placement{};
     ref_design_mod_loader *_loader;
     size_t _num_resouce_blks;
-    std::vector<sklk_phy_weight_page_id_t> _dl_pages{};
-    std::vector<sklk_phy_weight_page_id_t> _ul_pages{};
+    const bool _weighted_rotation;
+    const bool _proportional_fair;
+    std::vector<ref_design_group_rotation> _dl_pages{};
+    std::vector<ref_design_group_rotation> _ul_pages{};
+    ref_design_pf_table _dl_pf_table;
+    ref_design_pf_table _ul_pf_table;
+    //! Resource blocks with a group containing the stream of each proportional-fair entry, indexed by entry
+    std::vector<std::bitset<SKLK_PHY_MAX_BANDS>> _dl_stream_blocks;
+    std::vector<std::bitset<SKLK_PHY_MAX_BANDS>> _ul_stream_blocks;
+    //! Grouped streams left without a proportional-fair entry because the table was full, indexed by is_downlink
+    std::array<size_t, 2> _untracked_streams{};
+    ref_design_schedule_frame _schedule_frame{};
 
     ////////////////////////////////////////////////////////////////////
     // Grant stats
     ////////////////////////////////////////////////////////////////////
-    std::mutex _grant_stats_lock;
-    std::atomic_size_t _grant_stats_request_id{};
-    sklk_mii_message_queue<std::tuple<size_t, ssize_t, bool>, 100> _grant_stats_request_queue;
-    sklk_mii_message_queue<std::tuple<size_t, ssize_t, mimo_weight_page_id_t>, 1000> _grant_stats_response_queue;
+    //! Schedule requests since the last snapshot of the averaged rates
+    size_t _requests_since_snapshot{0};
+    //! Incremented for every snapshot the schedule thread publishes
+    uint64_t _snapshot_version{0};
+    //! Only the rotation that changed is published, indexed by [resource_blk_no][is_downlink]
+    std::array<std::array<ref_design_triple_buffer<ref_design_rotation_snapshot>, 2>, SKLK_PHY_MAX_BANDS> _rotation_snapshots{};
+    ref_design_triple_buffer<ref_design_rate_snapshot> _rate_snapshots;
+    //! Serializes the readers of the snapshots, the schedule thread never takes it
+    std::mutex _grant_snapshot_lock;
 
 public:
-    ref_design_schedule_mod(ref_design_mod_loader *loader, const mimo_rrh_scheduler_config &config);
+    ref_design_schedule_mod(ref_design_mod_loader *loader, const mimo_rrh_scheduler_config &config, const ref_design_config &mod_config);
     ~ref_design_schedule_mod() override = default;
 
     void ue_changed(size_t key, const sklk_phy_ue &ue, bool is_new) override;
@@ -37,9 +109,22 @@ public:
 
     void schedule_update(size_t frame_time, uint8_t sfn);
 
-    [[nodiscard]] nlohmann::json dump_grants(size_t resource_blk_no, bool is_downlink);
+    //! Groups of one resource block, or of every block when resource_blk_no is negative, from the latest snapshot
+    [[nodiscard]] nlohmann::json dump_grants(ssize_t resource_blk_no, bool is_downlink);
+
+    //! Placement applied to the module thread, null until the thread first ran
+    [[nodiscard]] nlohmann::json dump_thread_placement() const;
 
 private:
-    bool _handle_grant_stats();
-    void _send_grant_stats(size_t request_id, size_t resource_blk_no, bool is_downlink);
+    //! @return the number of invalid pages dropped
+    size_t _assign_pages(size_t resource_blk_no, bool is_downlink, const ref_design_weight_page_set &pages,
+                         const ref_design_group_keys &keys);
+    //! Drop the pages that became invalid from the blocks grouping the UE radio of the key
+    void _recheck_pages(size_t key);
+    //! Drop the pages that became invalid from every block
+    void _recheck_all_pages();
+    void _recheck_blocks(bool is_downlink, std::bitset<SKLK_PHY_MAX_BANDS> blocks);
+    size_t _schedule_group(const ref_design_group_rotation &rotation, ref_design_pf_table &pf_table, size_t frame_time);
+    void _publish_rotation(size_t resource_blk_no, bool is_downlink);
+    void _publish_rates();
 };
@@ -0,0 +1,166 @@
+#include "thread_policy.hpp"
+
+#include <sklk-mii/simple_log.hpp>
+
+#include <sklkphy/common.hpp>
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+
+#include <pthread.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+//! MPOL_PREFERRED from numaif.h, which is only installed with libnuma
+static constexpr int mpol_preferred{1};
+
+static const char *isolated_cpus_path{"/sys/devices/system/cpu/isolated"};
+
+void from_json(const nlohmann::json &j, ref_design_thread_policy &policy)
+{
+    policy.cpus = j.value("cpus", policy.cpus);
+    for (int cpu : policy.cpus) {
+        if (cpu < 0 or cpu >= CPU_SETSIZE)
+            throw std::invalid_argument("cpus must be 0 to " + std::to_string(CPU_SETSIZE - 1));
+    }
+    policy.fifo_priority = j.value("fifo_priority", policy.fifo_priority);
+    if (policy.fifo_priority < 0 or policy.fifo_priority > 99)
+        throw std::invalid_argument("fifo_priority must be 0 to 99");
+    policy.numa_node = j.value("numa_node", policy.numa_node);
+    if (policy.numa_node < -1 or policy.numa_node >= 64)
+        throw std::invalid_argument("numa_node must be -1 or 0 to 63");
+    policy.require_isolated = j.value("require_isolated", policy.require_isolated);
+}
+
+void to_json(nlohmann::json &j, const ref_design_thread_policy &policy)
+{
+    j = nlohmann::json{
+        {"cpus", policy.cpus},
+        {"fifo_priority", policy.fifo_priority},
+        {"numa_node", policy.numa_node},
+        {"require_isolated", policy.require_isolated},
+    };
+}
+
+void to_json(nlohmann::json &j, const ref_design_thread_placement &placement)
+{
+    j = nlohmann::json{
+        {"cpus", placement.cpus},
+        {"cpu", placement.cpu},
+        {"scheduler", placement.scheduler},
+        {"priority", placement.priority},
+        {"numa_node", placement.numa_node},
+        {"isolated", placement.isolated},
+        {"errors", placement.errors},
+    };
+}
+
+ref_design_thread_policy ref_design_pin_thread_policy(const ref_design_thread_policy &policy, size_t cpu_no)
+{
+    auto pinned = policy;
+    if (not policy.cpus.empty())
+        pinned.cpus = {policy.cpus[cpu_no%policy.cpus.size()]};
+    return pinned;
+}
+
+std::vector<int> ref_design_parse_cpu_list(const std::string &list)
+{
+    std::vector<int> cpus{};
+    std::stringstream stream(list);
+    std::string range;
+    while (std::getline(stream, range, ',')) {
+        int first{}, last{};
+        const int num_fields = std::sscanf(range.c_str(), "%d-%d", &first, &last);
+        if (num_fields < 1)
+            continue;
+        if (num_fields == 1)
+            last = first;
+        for (int cpu = first; cpu <= last; cpu++)
+            cpus.push_back(cpu);
+    }
+    return cpus;
+}
+
+static std::vector<int> isolated_cpus()
+{
+    std::ifstream file(isolated_cpus_path);
+    std::string list;
+    std::getline(file, list);
+    return ref_design_parse_cpu_list(list);
+}
+
+static bool all_isolated(const std::vector<int> &cpus, const std::vector<int> &isolated)
+{
+    return not cpus.empty() and std::all_of(cpus.begin(), cpus.end(), [&](int cpu) {
+        return std::find(isolated.begin(), isolated.end(), cpu) != isolated.end();
+    });
+}
+
+ref_design_thread_placement ref_design_apply_thread_policy(
+    const std::string &name, const ref_design_thread_policy &policy, double default_priority)
+{
+    ref_design_thread_placement placement{};
+    auto fail = [&](std::string error) {
+        sklk_mii_log::warn("{}: {}", name, error);
+        placement.errors.push_back(std::move(error));
+    };
+
+    const auto isolated = isolated_cpus();
+    if (not policy.cpus.empty()) {
+        if (policy.require_isolated and not all_isolated(policy.cpus, isolated)) {
+            fail("Not pinned, the CPUs are not all isolated");
+        } else {
+            cpu_set_t cpu_set;
+            CPU_ZERO(&cpu_set);
+            for (int cpu : policy.cpus) {
+                if (cpu >= 0 and cpu < CPU_SETSIZE)
+                    CPU_SET(cpu, &cpu_set);
+            }
+            if (pthread_setaffinity_np(pthread_self(), sizeof(cpu_set), &cpu_set) != 0)
+                fail("Could not set the CPU affinity");
+        }
+    }
+
+    if (policy.fifo_priority > 0) {
+        sched_param param{};
+        param.sched_priority = policy.fifo_priority;
+        if (pthread_setschedparam(pthread_self(), SCHED_FIFO, &param) != 0)
+            fail("Could not set SCHED_FIFO priority " + std::to_string(policy.fifo_priority));
+    } else if (sklk_mii_set_thread_priority(default_priority) < 0) {
+        fail("Could not set elevated thread priority");
+    }
+
+    if (policy.numa_node >= 0) {
+        // The policy of a thread applies to the pages it touches first, so set it before the module allocates
+        const unsigned long node_mask = policy.numa_node < 64 ? 1ul << policy.numa_node : 0;
+        if (node_mask == 0 or syscall(SYS_set_mempolicy, mpol_preferred, &node_mask, 64) != 0)
+            fail("Could not prefer NUMA node " + std::to_string(policy.numa_node));
+        else
+            placement.numa_node = policy.numa_node;
+    }
+
+    cpu_set_t cpu_set;
+    CPU_ZERO(&cpu_set);
+    if (pthread_getaffinity_np(pthread_self(), sizeof(cpu_set), &cpu_set) == 0) {
+        for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+            if (CPU_ISSET(cpu, &cpu_set))
+                placement.cpus.push_back(cpu);
+        }
+    }
+    placement.cpu = sched_getcpu();
+    placement.isolated = all_isolated(placement.cpus, isolated);
+
+    int scheduler{};
+    sched_param param{};
+    if (pthread_getschedparam(pthread_self(), &scheduler, &param) == 0) {
+        placement.scheduler = scheduler == SCHED_FIFO ? "fifo" : scheduler == SCHED_RR ? "rr" : "other";
+        placement.priority = param.sched_priority;
+    }
+
+    sklk_mii_log::info("{}: running on CPUs {} with {} priority {}", name, nlohmann::json(placement.cpus).dump(),
+                       placement.scheduler, placement.priority);
+    return placement;
+}
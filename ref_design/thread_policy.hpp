@@ -0,0 +1,58 @@
+#pragma once
+
+#include "api.hpp"
+
+#include <nlohmann/json.hpp>
+
+#include <string>
+#include <vector>
+
+//! Where a module thread runs and allocates, read from the mod config
+struct SKLK_PHY_MOD_REFDESIGN_API ref_design_thread_policy
+{
+    //! CPUs the thread may run on.  Empty leaves the affinity unchanged.
+    std::vector<int> cpus{};
+    //! SCHED_FIFO priority from 1 to 99.  0 keeps the default elevated priority of the module.
+    int fifo_priority{0};
+    //! NUMA node preferred for the allocations the thread makes once running, -1 to keep the default policy
+    int numa_node{-1};
+    //! Only pin the thread when every CPU in cpus is isolated from the kernel scheduler
+    bool require_isolated{false};
+};
+
+SKLK_PHY_MOD_REFDESIGN_API void from_json(const nlohmann::json &j, ref_design_thread_policy &policy);
+SKLK_PHY_MOD_REFDESIGN_API void to_json(nlohmann::json &j, const ref_design_thread_policy &policy);
+
+//! The placement a thread ended up with after applying its policy
+struct SKLK_PHY_MOD_REFDESIGN_API ref_design_thread_placement
+{
+    std::vector<int> cpus{};
+    //! CPU the thread was running on when the policy was applied
+    int cpu{-1};
+    std::string scheduler{};
+    int priority{0};
+    int numa_node{-1};
+    //! Every CPU the thread may run on is isolated
+    bool isolated{false};
+    //! Parts of the policy that could not be applied
+    std::vector<std::string> errors{};
+};
+
+SKLK_PHY_MOD_REFDESIGN_API void to_json(nlohmann::json &j, const ref_design_thread_placement &placement);
+
+//! The policy pinned to cpus[cpu_no] alone, so threads sharing a policy each get their own CPU.  A policy without
+//! CPUs is returned unchanged.
+[[nodiscard]] SKLK_PHY_MOD_REFDESIGN_API ref_design_thread_policy ref_design_pin_thread_policy(
+    const ref_design_thread_policy &policy, size_t cpu_no);
+
+//! Parse a kernel CPU list such as "0-3,8,10-11"
+[[nodiscard]] SKLK_PHY_MOD_REFDESIGN_API std::vector<int> ref_design_parse_cpu_list(const std::string &list);
+
+/**
+ * Apply the policy to the calling thread.  Failures are logged and reported in the placement, the thread keeps
+ * running wherever it was.
+ *
+ * @param default_priority priority passed to sklk_mii_set_thread_priority when the policy sets no FIFO priority
+ */
+SKLK_PHY_MOD_REFDESIGN_API ref_design_thread_placement ref_design_apply_thread_policy(
+    const std::string &name, const ref_design_thread_policy &policy, double default_priority);
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+
+/**
+ * Lock-free hand off of the latest value from one writer thread to one reader thread.
+ *
+ * The writer fills the back buffer and publishes it, which swaps it with the middle buffer.  The reader takes the
+ * middle buffer as its front buffer when a new one has been published.  Neither side ever waits, the reader always
+ * sees the latest complete value, and values the reader was too slow to take are overwritten instead of queued.
+ */
+template <typename T>
+class ref_design_triple_buffer
+{
+    //! Set in _middle when it holds a value the reader has not taken
+    static constexpr uint8_t _fresh{4};
+    static constexpr uint8_t _index_mask{3};
+
+    std::array<T, 3> _buffers{};
+    alignas(64) std::atomic<uint8_t> _middle{1};
+    alignas(64) uint8_t _back{0};
+    alignas(64) uint8_t _front{2};
+
+public:
+    ref_design_triple_buffer() = default;
+
+    //! Start every buffer as a copy of initial, so buffers holding containers are sized before either side runs
+    explicit ref_design_triple_buffer(const T &initial) :
+        _buffers{initial, initial, initial}
+    {
+    }
+
+    //! Writer only, the buffer to fill before publish()
+    [[nodiscard]] T &back() { return _buffers[_back]; }
+
+    //! Writer only, make the back buffer the latest value
+    //! @return true when this replaced a value the reader had not taken
+    bool publish()
+    {
+        const uint8_t middle = _middle.exchange(_back | _fresh, std::memory_order_acq_rel);
+        _back = middle & _index_mask;
+        return middle & _fresh;
+    }
+
+    //! Reader only, take the latest published value as the front buffer
+    //! @return false when nothing was published since the last update
+    bool update()
+    {
+        if (not (_middle.load(std::memory_order_relaxed) & _fresh))
+            return false;
+        _front = _middle.exchange(_front, std::memory_order_acq_rel) & _index_mask;
+        return true;
+    }
+
+    //! Reader only
+    [[nodiscard]] T &front() { return _buffers[_front]; }
+};
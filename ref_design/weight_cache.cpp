@@ -0,0 +1,121 @@
+#include "weight_cache.hpp"
+
+#include <algorithm>
+#include <numeric>
+
+static uint64_t mix(uint64_t hash, uint64_t value)
+{
+    // The hash_combine step of boost, the full compare on a match resolves collisions
+    hash ^= value + 0x9e3779b97f4a7c15ull + (hash << 6) + (hash >> 2);
+    return hash;
+}
+
+size_t ref_design_weight_cache::entry_bytes(size_t num_estimations)
+{
+    return num_estimations*SKLK_PHY_MAX_MIMO_USERS*(SKLK_PHY_MAX_RADIOS*sizeof(sklk_mii_cf_t) + sizeof(uint64_t)) +
+           SKLK_PHY_MAX_MIMO_USERS*sizeof(size_t) + 4*sizeof(uint64_t) + 2;
+}
+
+ref_design_weight_cache::ref_design_weight_cache(size_t max_bytes, size_t num_estimations) :
+    _num_estimations(num_estimations),
+    _capacity(num_estimations ? max_bytes/entry_bytes(num_estimations) : 0),
+    _hashes(_capacity),
+    _last_used(_capacity),
+    _resource_blks(_capacity),
+    _inputs_versions(_capacity),
+    _is_downlink(_capacity),
+    _num_users(_capacity),
+    _ue_keys(_capacity*SKLK_PHY_MAX_MIMO_USERS),
+    _csi_versions(_capacity*num_estimations*SKLK_PHY_MAX_MIMO_USERS),
+    _weights(_capacity*num_estimations*SKLK_PHY_MAX_MIMO_USERS*SKLK_PHY_MAX_RADIOS)
+{
+}
+
+uint64_t ref_design_weight_cache::_sort_key(const ref_design_weight_cache_key &key, uint8_t *order) const
+{
+    std::iota(order, order + key.num_users, 0);
+    std::sort(order, order + key.num_users, [&](uint8_t a, uint8_t b) { return key.ue_keys[a] < key.ue_keys[b]; });
+
+    uint64_t hash = mix(mix(mix(0, key.resource_blk_no), key.is_downlink), key.inputs_version);
+    for (size_t i = 0; i < key.num_users; i++)
+        hash = mix(hash, key.ue_keys[order[i]]);
+    for (size_t est_idx = 0; est_idx < _num_estimations; est_idx++) {
+        for (size_t i = 0; i < key.num_users; i++)
+            hash = mix(hash, key.csi_versions[est_idx*key.num_users + order[i]]);
+    }
+    // 0 marks unused entries
+    return hash ? hash : 1;
+}
+
+bool ref_design_weight_cache::_matches(size_t entry, const ref_design_weight_cache_key &key, const uint8_t *order) const
+{
+    if (_resource_blks[entry] != key.resource_blk_no or _is_downlink[entry] != key.is_downlink or
+        _inputs_versions[entry] != key.inputs_version or _num_users[entry] != key.num_users)
+        return false;
+
+    const size_t *ue_keys = _ue_keys.data() + entry*SKLK_PHY_MAX_MIMO_USERS;
+    const uint64_t *csi_versions = _csi_versions.data() + entry*_num_estimations*SKLK_PHY_MAX_MIMO_USERS;
+    for (size_t i = 0; i < key.num_users; i++) {
+        if (ue_keys[i] != key.ue_keys[order[i]])
+            return false;
+        for (size_t est_idx = 0; est_idx < _num_estimations; est_idx++) {
+            if (csi_versions[est_idx*SKLK_PHY_MAX_MIMO_USERS + i] != key.csi_versions[est_idx*key.num_users + order[i]])
+                return false;
+        }
+    }
+    return true;
+}
+
+size_t ref_design_weight_cache::find(const ref_design_weight_cache_key &key)
+{
+    if (_capacity == 0 or key.num_users == 0 or key.num_users > SKLK_PHY_MAX_MIMO_USERS)
+        return invalid_entry;
+
+    uint8_t order[SKLK_PHY_MAX_MIMO_USERS];
+    const uint64_t hash = _sort_key(key, order);
+    for (size_t entry = 0; entry < _capacity; entry++) {
+        if (_hashes[entry] == hash and _matches(entry, key, order)) {
+            _last_used[entry] = ++_clock;
+            return entry;
+        }
+    }
+    return invalid_entry;
+}
+
+size_t ref_design_weight_cache::insert(const ref_design_weight_cache_key &key)
+{
+    if (_capacity == 0 or key.num_users == 0 or key.num_users > SKLK_PHY_MAX_MIMO_USERS)
+        return invalid_entry;
+
+    uint8_t order[SKLK_PHY_MAX_MIMO_USERS];
+    const uint64_t hash = _sort_key(key, order);
+    // Unused entries have never been used, so they are the least recently used
+    const size_t entry = std::min_element(_last_used.begin(), _last_used.end()) - _last_used.begin();
+
+    _hashes[entry] = hash;
+    _last_used[entry] = ++_clock;
+    _resource_blks[entry] = key.resource_blk_no;
+    _is_downlink[entry] = key.is_downlink;
+    _inputs_versions[entry] = key.inputs_version;
+    _num_users[entry] = key.num_users;
+    size_t *ue_keys = _ue_keys.data() + entry*SKLK_PHY_MAX_MIMO_USERS;
+    uint64_t *csi_versions = _csi_versions.data() + entry*_num_estimations*SKLK_PHY_MAX_MIMO_USERS;
+    for (size_t i = 0; i < key.num_users; i++) {
+        ue_keys[i] = key.ue_keys[order[i]];
+        for (size_t est_idx = 0; est_idx < _num_estimations; est_idx++)
+            csi_versions[est_idx*SKLK_PHY_MAX_MIMO_USERS + i] = key.csi_versions[est_idx*key.num_users + order[i]];
+    }
+    return entry;
+}
+
+size_t ref_design_weight_cache::_user(size_t entry, size_t ue_key) const
+{
+    const size_t *ue_keys = _ue_keys.data() + entry*SKLK_PHY_MAX_MIMO_USERS;
+    return std::lower_bound(ue_keys, ue_keys + _num_users[entry], ue_key) - ue_keys;
+}
+
+sklk_mii_cf_t *ref_design_weight_cache::weights(size_t entry, size_t ue_key, size_t est_idx)
+{
+    const size_t user = _user(entry, ue_key);
+    return _weights.data() + ((entry*_num_estimations + est_idx)*SKLK_PHY_MAX_MIMO_USERS + user)*SKLK_PHY_MAX_RADIOS;
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include "api.hpp"
+
+#include <sklkphy/common.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+//! What the weights of a page depend on, the users in any order
+struct SKLK_PHY_MOD_REFDESIGN_API ref_design_weight_cache_key
+{
+    size_t resource_blk_no;
+    bool is_downlink;
+    //! Changes whenever something other than the CSI of a user changes the channel matrix
+    uint64_t inputs_version;
+    const size_t *ue_keys;
+    //! Material CSI version of each user for each estimation, indexed by [est_idx*num_users + userno]
+    const uint64_t *csi_versions;
+    size_t num_users;
+};
+
+/**
+ * Least recently used weights of recent groups, so a group that comes back with unchanged inputs is not solved again.
+ *
+ * Every entry has room for the weights of SKLK_PHY_MAX_MIMO_USERS users and is allocated when the cache is created,
+ * so looking up and inserting never allocate.  Entries are found by scanning their hashes, which stays cheap for
+ * the few hundred entries a memory cap of a few megabytes allows next to the cost of one solve.
+ */
+class SKLK_PHY_MOD_REFDESIGN_API ref_design_weight_cache
+{
+public:
+    static constexpr size_t invalid_entry{SIZE_MAX};
+
+private:
+    const size_t _num_estimations;
+    size_t _capacity{0};
+    uint64_t _clock{0};
+    //! Per entry, 0 for unused entries
+    std::vector<uint64_t> _hashes;
+    std::vector<uint64_t> _last_used;
+    std::vector<size_t> _resource_blks;
+    std::vector<uint64_t> _inputs_versions;
+    std::vector<uint8_t> _is_downlink;
+    std::vector<uint8_t> _num_users;
+    //! Users of each entry sorted by key, [entry][user]
+    std::vector<size_t> _ue_keys;
+    //! [entry][est_idx][user] in the sorted user order
+    std::vector<uint64_t> _csi_versions;
+    //! [entry][est_idx][user][radio] in the sorted user order
+    std::vector<sklk_mii_cf_t> _weights;
+
+public:
+    //! @param max_bytes memory of all entries together, 0 disables the cache
+    ref_design_weight_cache(size_t max_bytes, size_t num_estimations);
+
+    [[nodiscard]] size_t capacity() const { return _capacity; }
+
+    //! Bytes needed by one entry
+    [[nodiscard]] static size_t entry_bytes(size_t num_estimations);
+
+    //! @return the entry with the weights for the key, or invalid_entry
+    [[nodiscard]] size_t find(const ref_design_weight_cache_key &key);
+
+    //! Make room for the weights of the key, replacing the least recently used entry
+    //! @return the entry to fill with weights(), or invalid_entry when the cache is disabled
+    size_t insert(const ref_design_weight_cache_key &key);
+
+    //! SKLK_PHY_MAX_RADIOS weights of one user of an entry, indexed by radio channel
+    [[nodiscard]] sklk_mii_cf_t *weights(size_t entry, size_t ue_key, size_t est_idx);
+
+private:
+    //! Sort the users of the key into order, and @return the hash of the key
+    uint64_t _sort_key(const ref_design_weight_cache_key &key, uint8_t *order) const;
+    [[nodiscard]] bool _matches(size_t entry, const ref_design_weight_cache_key &key, const uint8_t *order) const;
+    [[nodiscard]] size_t _user(size_t entry, size_t ue_key) const;
+};
@@ -0,0 +1,83 @@
+#include "weight_solver.hpp"
+#include "arma.hpp"
+#include "batched_kernels.hpp"
+
+std::string to_string(ref_design_weight_solver solver)
+{
+    switch (solver) {
+    case ref_design_weight_solver::pinv_std: return "pinv_std";
+    case ref_design_weight_solver::pinv_dc: return "pinv_dc";
+    case ref_design_weight_solver::zf_cholesky: return "zf_cholesky";
+    case ref_design_weight_solver::rzf: return "rzf";
+    }
+    return "unknown";
+}
+
+bool from_string(const std::string &name, ref_design_weight_solver &solver)
+{
+    for (auto candidate : {ref_design_weight_solver::pinv_std, ref_design_weight_solver::pinv_dc,
+                           ref_design_weight_solver::zf_cholesky, ref_design_weight_solver::rzf}) {
+        if (name == to_string(candidate)) {
+            solver = candidate;
+            return true;
+        }
+    }
+    if (name == "mmse") {
+        solver = ref_design_weight_solver::rzf;
+        return true;
+    }
+    return false;
+}
+
+/**
+ * B = A^H (A A^H + lambda I)^-1 = (R^-1 R^-H A)^H where A A^H + lambda I = R^H R.
+ */
+static bool solve_cholesky(arma::Mat<sklk_mii_cf_t> &B, const arma::Mat<sklk_mii_cf_t> &A, float regularization)
+{
+    arma::Mat<sklk_mii_cf_t> gram = A*A.t();
+    const float mean_power = std::real(arma::trace(gram))/gram.n_rows;
+    if (not (mean_power > 0.0f))
+        return false;
+    if (regularization > 0.0f)
+        gram.diag() += sklk_mii_cf_t{regularization*mean_power};
+
+    arma::Mat<sklk_mii_cf_t> R;
+    if (not arma::chol(R, gram, "upper"))
+        return false;
+    // Same guard as the batched solver, a nearly singular Gram matrix would give huge weights
+    for (arma::uword i = 0; i < R.n_rows; i++) {
+        const float pivot = std::norm(R(i, i));
+        if (not (pivot > ref_design_min_pivot*mean_power))
+            return false;
+    }
+
+    arma::Mat<sklk_mii_cf_t> Y;
+    arma::Mat<sklk_mii_cf_t> X;
+    if (not arma::solve(Y, arma::trimatl(R.t()), A, arma::solve_opts::no_approx))
+        return false;
+    if (not arma::solve(X, arma::trimatu(R), Y, arma::solve_opts::no_approx))
+        return false;
+    B = X.t();
+    return true;
+}
+
+bool ref_design_solve_weights(
+    arma::Mat<sklk_mii_cf_t> &B, const arma::Mat<sklk_mii_cf_t> &A, ref_design_weight_solver solver, float regularization)
+{
+    switch (solver) {
+    case ref_design_weight_solver::pinv_dc:
+        //the divide-and-conquer method provides slightly different results than the standard method, but is considerably faster for large matrices
+        return arma::pinv(B, A, 0, "dc");
+    case ref_design_weight_solver::zf_cholesky:
+        if (solve_cholesky(B, A, 0.0f))
+            return true;
+        break;
+    case ref_design_weight_solver::rzf:
+        if (solve_cholesky(B, A, regularization))
+            return true;
+        break;
+    case ref_design_weight_solver::pinv_std:
+        break;
+    }
+    return arma::pinv(B, A, 0, "std");
+}
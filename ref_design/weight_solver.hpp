@@ -0,0 +1,46 @@
+#pragma once
+
+#include "api.hpp"
+
+#include <sklkphy/common.hpp>
+
+#include <string>
+
+namespace arma {
+template <typename eT> class Mat;
+}
+
+/**
+ * Methods for calculating the beam-forming weights B from the channel matrix A (users x radios).
+ */
+enum class ref_design_weight_solver
+{
+    //! Pseudo-inverse using the standard SVD
+    pinv_std,
+    //! Pseudo-inverse using the divide-and-conquer SVD
+    pinv_dc,
+    //! Zero-forcing, A^H (A A^H)^-1, using a Cholesky factorization of the users x users Gram matrix
+    zf_cholesky,
+    //! Regularized zero-forcing (MMSE), A^H (A A^H + lambda I)^-1, using a Cholesky factorization
+    rzf,
+};
+
+SKLK_PHY_MOD_REFDESIGN_API std::string to_string(ref_design_weight_solver solver);
+
+/**
+ * Parse a solver name.  "mmse" is accepted as an alias of "rzf".
+ * @return false if the name is not a known solver
+ */
+SKLK_PHY_MOD_REFDESIGN_API bool from_string(const std::string &name, ref_design_weight_solver &solver);
+
+/**
+ * Calculate the weights B (radios x users) for the channel matrix A (users x radios).
+ *
+ * The Cholesky based solvers fall back to the standard pseudo-inverse when the Gram matrix is not positive
+ * definite or a pivot is below ref_design_min_pivot, for example when there are more users than radios.
+ *
+ * @param regularization lambda for the rzf solver, relative to the mean diagonal of A A^H
+ * @return false if the weights could not be calculated
+ */
+SKLK_PHY_MOD_REFDESIGN_API bool ref_design_solve_weights(
+    arma::Mat<sklk_mii_cf_t> &B, const arma::Mat<sklk_mii_cf_t> &A, ref_design_weight_solver solver, float regularization);
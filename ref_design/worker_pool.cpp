@@ -0,0 +1,137 @@
+#include "worker_pool.hpp"
+
+#include <sklk-mii/simple_log.hpp>
+
+#include <cassert>
+
+#include <pthread.h>
+#include <sched.h>
+
+static constexpr uint64_t pack_range(uint64_t begin, uint64_t end)
+{
+    return (begin << 32) | end;
+}
+
+ref_design_worker_pool::ref_design_worker_pool(size_t num_threads, const std::vector<int> &cpus, size_t first_cpu) :
+    _ranges(new job_range[num_threads + 1])
+{
+    _threads.reserve(num_threads);
+    for (size_t i = 0; i < num_threads; i++) {
+        _threads.emplace_back(&ref_design_worker_pool::_worker, this, i);
+        if (cpus.empty())
+            continue;
+
+        const int cpu = cpus[(first_cpu + i) % cpus.size()];
+        cpu_set_t cpu_set;
+        CPU_ZERO(&cpu_set);
+        CPU_SET(cpu, &cpu_set);
+        if (pthread_setaffinity_np(_threads.back().native_handle(), sizeof(cpu_set), &cpu_set) != 0)
+            sklk_mii_log::warn("Could not pin weight worker {} to CPU {}", i, cpu);
+    }
+}
+
+ref_design_worker_pool::~ref_design_worker_pool()
+{
+    {
+        std::lock_guard guard(_lock);
+        _stop = true;
+    }
+    _wake.notify_all();
+    for (auto &thread : _threads)
+        thread.join();
+}
+
+void ref_design_worker_pool::_run(size_t num_jobs, invoke_t invoke, void *ctx)
+{
+    if (num_jobs == 0)
+        return;
+
+    if (_threads.empty()) {
+        for (size_t job_no = 0; job_no < num_jobs; job_no++)
+            invoke(ctx, job_no);
+        return;
+    }
+
+    assert(num_jobs <= UINT32_MAX);
+    assert(_remaining == 0);
+    _invoke = invoke;
+    _ctx = ctx;
+    _remaining = num_jobs;
+
+    // Publishing the ranges releases the batch to any worker that is still looking for jobs
+    const size_t participants = _threads.size() + 1;
+    for (size_t participant = 0; participant < participants; participant++) {
+        const uint64_t begin = num_jobs*participant/participants;
+        const uint64_t end = num_jobs*(participant + 1)/participants;
+        _ranges[participant].range.store(pack_range(begin, end), std::memory_order_release);
+    }
+
+    {
+        std::lock_guard guard(_lock);
+        _generation++;
+    }
+    _wake.notify_all();
+
+    // The caller is the last participant, then waits on the per-batch barrier
+    _run_jobs(_threads.size());
+    if (_remaining.load(std::memory_order_acquire) != 0) {
+        std::unique_lock lock(_done_lock);
+        _done.wait(lock, [&] { return _remaining.load(std::memory_order_acquire) == 0; });
+    }
+}
+
+void ref_design_worker_pool::_worker(size_t participant)
+{
+    size_t generation{0};
+    while (true) {
+        {
+            std::unique_lock lock(_lock);
+            _wake.wait(lock, [&] { return _stop or _generation != generation; });
+            if (_stop)
+                return;
+            generation = _generation;
+        }
+        _run_jobs(participant);
+    }
+}
+
+void ref_design_worker_pool::_run_jobs(size_t participant)
+{
+    size_t job_no{};
+    while (_take(participant, job_no)) {
+        _invoke(_ctx, job_no);
+        if (_remaining.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            // Taking the lock orders the notification after the caller checked _remaining, so it is not lost
+            std::lock_guard guard(_done_lock);
+            _done.notify_one();
+        }
+    }
+}
+
+bool ref_design_worker_pool::_take(size_t participant, size_t &job_no)
+{
+    const size_t participants = _threads.size() + 1;
+
+    // Take from the front of our own range
+    auto &own = _ranges[participant].range;
+    uint64_t range = own.load(std::memory_order_acquire);
+    while ((range >> 32) < (range & UINT32_MAX)) {
+        if (own.compare_exchange_weak(range, range + (uint64_t{1} << 32), std::memory_order_acq_rel)) {
+            job_no = range >> 32;
+            return true;
+        }
+    }
+
+    // Steal from the back of the other ranges
+    for (size_t offset = 1; offset < participants; offset++) {
+        auto &victim = _ranges[(participant + offset) % participants].range;
+        range = victim.load(std::memory_order_acquire);
+        while ((range >> 32) < (range & UINT32_MAX)) {
+            if (victim.compare_exchange_weak(range, range - 1, std::memory_order_acq_rel)) {
+                job_no = (range & UINT32_MAX) - 1;
+                return true;
+            }
+        }
+    }
+    return false;
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include "api.hpp"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+/**
+ * A fixed pool of worker threads running batches of independent jobs.
+ *
+ * Each batch is split into one range of job numbers per participant.  A participant takes jobs from the front
+ * of its own range and steals from the back of the other ranges once its range is empty.  The thread calling
+ * run() participates in the batch, and run() only returns once every job in the batch has completed.
+ *
+ * The caller blocks at the end of the batch instead of spinning, so a worker sharing its CPU with a caller of a
+ * higher priority can still finish the jobs it took.
+ */
+class SKLK_PHY_MOD_REFDESIGN_API ref_design_worker_pool
+{
+    //! Job numbers [begin, end) packed as (begin << 32) | end, padded to avoid false sharing
+    struct alignas(64) job_range
+    {
+        std::atomic_uint64_t range{0};
+    };
+
+    using invoke_t = void (*)(void *ctx, size_t job_no);
+
+    std::vector<std::thread> _threads{};
+    std::unique_ptr<job_range[]> _ranges;
+    invoke_t _invoke{nullptr};
+    void *_ctx{nullptr};
+    std::atomic_size_t _remaining{0};
+
+    std::mutex _lock;
+    std::condition_variable _wake;
+    size_t _generation{0};
+    bool _stop{false};
+
+    //! Signalled by the participant completing the last job of a batch
+    std::mutex _done_lock;
+    std::condition_variable _done;
+
+public:
+    /**
+     * @param num_threads number of threads in addition to the caller of run()
+     * @param cpus CPUs the threads are pinned to, assigned round-robin.  Empty leaves the threads unpinned.
+     * @param first_cpu index in cpus of the CPU of the first thread, so pools sharing a list take different CPUs
+     */
+    ref_design_worker_pool(size_t num_threads, const std::vector<int> &cpus, size_t first_cpu = 0);
+    ~ref_design_worker_pool();
+
+    ref_design_worker_pool(const ref_design_worker_pool &) = delete;
+    ref_design_worker_pool &operator=(const ref_design_worker_pool &) = delete;
+
+    [[nodiscard]] size_t num_threads() const { return _threads.size(); }
+
+    /**
+     * Call fn(job_no) for every job_no in [0, num_jobs) and wait for all of them to complete.
+     */
+    template <typename Fn>
+    void run(size_t num_jobs, Fn &&fn)
+    {
+        using fn_t = std::remove_reference_t<Fn>;
+        _run(num_jobs, [](void *ctx, size_t job_no) { (*static_cast<fn_t *>(ctx))(job_no); }, &fn);
+    }
+
+private:
+    void _run(size_t num_jobs, invoke_t invoke, void *ctx);
+    void _worker(size_t participant);
+    bool _take(size_t participant, size_t &job_no);
+    void _run_jobs(size_t participant);
+};
@@ -0,0 +1,124 @@
+#include <sklk-cpptest.hpp>
+
+#include "batched_kernels.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <complex>
+#include <random>
+#include <vector>
+
+static void fill_batch(ref_design_zf_batch &batch, size_t num_users, std::mt19937 &generator)
+{
+    std::normal_distribution<float> distr(0.0f, 1.0f);
+    for (size_t problem = 0; problem < batch.num_problems(); problem++) {
+        batch.set_num_users(problem, num_users);
+        for (size_t user = 0; user < num_users; user++) {
+            for (size_t radio = 0; radio < batch.num_radios(); radio++) {
+                batch.a_re(problem, user)[radio] = distr(generator);
+                batch.a_im(problem, user)[radio] = distr(generator);
+            }
+        }
+    }
+}
+
+TEST(TestRefDesignBatchedKernels, KernelsMatchScalar)
+{
+    std::mt19937 generator(1);
+    std::uniform_real_distribution<float> distr(-1.0f, 1.0f);
+    const size_t n = 4*ref_design_kernel_width;
+
+    ref_design_zf_batch batch;
+    batch.resize(1, 2, n);
+    for (size_t i = 0; i < n; i++) {
+        batch.a_re(0, 0)[i] = distr(generator);
+        batch.a_im(0, 0)[i] = distr(generator);
+        batch.a_re(0, 1)[i] = distr(generator);
+        batch.a_im(0, 1)[i] = distr(generator);
+    }
+
+    const auto &scalar = ref_design_complex_kernels::scalar();
+    float expected_re{};
+    float expected_im{};
+    scalar.dot_conj(batch.a_re(0, 0), batch.a_im(0, 0), batch.a_re(0, 1), batch.a_im(0, 1), n, expected_re, expected_im);
+
+    for (const char *name : {"scalar", "avx2", "avx512"}) {
+        const auto *kernels = ref_design_complex_kernels::find(name);
+        if (kernels == nullptr)
+            continue;
+        float re{};
+        float im{};
+        kernels->dot_conj(batch.a_re(0, 0), batch.a_im(0, 0), batch.a_re(0, 1), batch.a_im(0, 1), n, re, im);
+        EXPECT_NEAR(re, expected_re, 1e-4);
+        EXPECT_NEAR(im, expected_im, 1e-4);
+    }
+}
+
+TEST(TestRefDesignBatchedKernels, PowerMatchesScalar)
+{
+    std::mt19937 generator(5);
+    std::uniform_real_distribution<float> distr(-1.0f, 1.0f);
+    const size_t n = 4*ref_design_kernel_width;
+
+    ref_design_zf_batch batch;
+    batch.resize(1, 1, n);
+    float expected_sum{};
+    float expected_max{};
+    for (size_t i = 0; i < n; i++) {
+        batch.a_re(0, 0)[i] = distr(generator);
+        batch.a_im(0, 0)[i] = distr(generator);
+        const float mag2 = std::norm(std::complex<float>(batch.a_re(0, 0)[i], batch.a_im(0, 0)[i]));
+        expected_sum += mag2;
+        expected_max = std::max(expected_max, mag2);
+    }
+
+    for (const char *name : {"scalar", "avx2", "avx512"}) {
+        const auto *kernels = ref_design_complex_kernels::find(name);
+        if (kernels == nullptr)
+            continue;
+        float sum{};
+        float max{};
+        kernels->power(batch.a_re(0, 0), batch.a_im(0, 0), n, sum, max);
+        EXPECT_NEAR(sum, expected_sum, 1e-3);
+        EXPECT_FLOAT_EQ(max, expected_max);
+    }
+}
+
+TEST(TestRefDesignBatchedKernels, ZeroForcingInvertsChannel)
+{
+    std::mt19937 generator(2);
+    for (const char *name : {"scalar", "auto"}) {
+        const auto *kernels = ref_design_complex_kernels::find(name);
+        ASSERT_TRUE(kernels != nullptr);
+
+        ref_design_zf_batch batch;
+        batch.resize(8, 6, 40);
+        fill_batch(batch, 6, generator);
+        batch.solve(0, batch.num_problems(), 0.0f, *kernels);
+
+        for (size_t problem = 0; problem < batch.num_problems(); problem++) {
+            ASSERT_TRUE(batch.ok(problem));
+            for (size_t i = 0; i < 6; i++) {
+                for (size_t j = 0; j < 6; j++) {
+                    // (A B)[i][j] with B = X^H
+                    float re{};
+                    float im{};
+                    ref_design_complex_kernels::scalar().dot_conj(
+                        batch.a_re(problem, i), batch.a_im(problem, i), batch.x_re(problem, j), batch.x_im(problem, j), 40, re, im);
+                    EXPECT_NEAR(re, i == j ? 1.0f : 0.0f, 1e-3);
+                    EXPECT_NEAR(im, 0.0f, 1e-3);
+                }
+            }
+        }
+    }
+}
+
+TEST(TestRefDesignBatchedKernels, RankDeficientFails)
+{
+    std::mt19937 generator(3);
+    ref_design_zf_batch batch;
+    batch.resize(1, 4, 2);
+    fill_batch(batch, 4, generator);
+    batch.solve(0, 1, 0.0f);
+    EXPECT_FALSE(batch.ok(0));
+}
@@ -0,0 +1,392 @@
+#include <sklk-cpptest.hpp>
+
+#include "csi_mod.hpp"
+#include "csi_router.hpp"
+#include "loader.hpp"
+
+#include <cstdint>
+#include <map>
+#include <memory>
+
+static constexpr size_t num_blks{2};
+static constexpr size_t num_estimations{2};
+static constexpr size_t num_radios{4};
+
+//! A CSI module with its own UE radio containers and weight pages, so it runs without a PHY
+class test_csi_mod : public ref_design_csi_mod
+{
+public:
+    using ref_design_csi_mod::ref_design_csi_mod;
+
+    std::map<size_t, std::shared_ptr<ref_design_csi_radio_container>> containers{};
+    size_t new_pages{0};
+
+    void add_ue_radio(size_t key)
+    {
+        ue_radio_map.emplace(key, sklk_phy_ue_radio{});
+        containers[key] = std::dynamic_pointer_cast<ref_design_csi_radio_container>(allocate_ue_radio());
+        ue_radio_changed(key, ue_radio_map.at(key), true);
+    }
+
+    void remove_ue_radio(size_t key)
+    {
+        ue_radio_map.erase(key);
+        containers.erase(key);
+    }
+
+    void change_ue_radio(size_t key)
+    {
+        ue_radio_changed(key, ue_radio_map.at(key), false);
+    }
+
+    //! Change a stream of the UE radio, which has its own key
+    void change_ue_stream(size_t stream_key, size_t ue_radio_key)
+    {
+        _stream_ue_radio = ue_radio_key;
+        ue_stream_changed(stream_key, sklk_phy_ue_stream{}, false);
+    }
+
+    //! Enable and calibrate the radios, the downlink uses the CSI with the calibration applied
+    void enable_radios()
+    {
+        for (size_t radio_ch = 0; radio_ch < num_radios; radio_ch++) {
+            _msg_queues.enable_radio.send(sklk_phy_mod_enable_radio_msg_t{0, radio_ch, true});
+            for (size_t resource_blk_no = 0; resource_blk_no < num_blks; resource_blk_no++) {
+                for (size_t est_idx = 0; est_idx < num_estimations; est_idx++) {
+                    if (owns(resource_blk_no))
+                        route_cc({0, radio_ch, resource_blk_no, est_idx, sklk_mii_cf_t{1.0f, 0.0f}});
+                }
+            }
+        }
+    }
+
+    //! CSI of every estimation of the block
+    void send_csi(size_t frame_time, size_t key, size_t resource_blk_no, float gain = 1.0f)
+    {
+        for (size_t est_idx = 0; est_idx < num_estimations; est_idx++)
+            route_csi({frame_time, key, ue_radio_map.at(key), resource_blk_no, est_idx, csi(key, gain)});
+    }
+
+    void send_csi_of_all_blocks(size_t frame_time)
+    {
+        for (const auto &[key, ue_radio] : ue_radio_map) {
+            for (size_t resource_blk_no = 0; resource_blk_no < num_blks; resource_blk_no++) {
+                if (owns(resource_blk_no))
+                    send_csi(frame_time, key, resource_blk_no);
+            }
+        }
+    }
+
+    [[nodiscard]] size_t stat(const char *name) const { return dump_stats().at(name).get<size_t>(); }
+
+    //! Strongest on the radio matching the key, so any two UE radios can be grouped
+    static sklk_phy_csi_vec csi(size_t key, float gain)
+    {
+        sklk_phy_csi_vec vec{};
+        for (size_t radio_ch = 0; radio_ch < num_radios; radio_ch++)
+            vec[radio_ch] = {radio_ch == key%num_radios ? gain : 0.1f*gain, 0.05f*float(radio_ch)};
+        return vec;
+    }
+
+protected:
+    std::shared_ptr<ref_design_csi_radio_container> _get_container(size_t key, const sklk_phy_ue_radio &ue_radio [[maybe_unused]]) override
+    {
+        auto it = containers.find(key);
+        return it == containers.end() ? nullptr : it->second;
+    }
+
+    sklk_phy_weight_page_id_t _new_weight_page(const ref_design_pending_weight_page &pending [[maybe_unused]]) override
+    {
+        new_pages++;
+        auto page = std::make_shared<sklk_phy_weight_page>();
+        return {page, reinterpret_cast<sklk_phy_weight_page_id_t::element_type *>(page.get())};
+    }
+
+    sklk_phy_weight_page &_weight_page(const sklk_phy_weight_page_id_t &page_hdl) override
+    {
+        return *reinterpret_cast<sklk_phy_weight_page *>(page_hdl.get());
+    }
+
+    //! The key the module recorded in the container of the UE radio
+    size_t _ue_radio_key(const sklk_phy_ue_stream &ue_stream [[maybe_unused]]) override
+    {
+        auto it = containers.find(_stream_ue_radio);
+        return it == containers.end() ? ref_design_csi_radio_container::invalid_key : it->second->ue_radio_key.load();
+    }
+
+    bool _page_is_valid(const sklk_phy_weight_page_id_t &page_hdl) override { return page_hdl != nullptr; }
+    void _set_page_status(const sklk_phy_weight_page_id_t &page_hdl [[maybe_unused]], bool ok [[maybe_unused]]) override {}
+
+private:
+    size_t _stream_ue_radio{0};
+};
+
+class test_csi_router : public ref_design_csi_router
+{
+public:
+    using ref_design_csi_router::ref_design_csi_router;
+
+    void send_csi(sklk_phy_mod_csi_msg_t msg) { _msg_queues.csi.send(std::move(msg)); }
+};
+
+static mimo_rrh_scheduler_config scheduler_config()
+{
+    mimo_rrh_scheduler_config config{};
+    config.num_bands = num_blks;
+    config.max_users_per_group = 2;
+    config.num_pilot_estimates = num_estimations;
+    return config;
+}
+
+static ref_design_config mod_config()
+{
+    // The batched solver does not need armadillo
+    ref_design_config config{};
+    config.weight_solver = ref_design_weight_solver::zf_cholesky;
+    config.zf_kernels = "scalar";
+    return config;
+}
+
+//! Users of the first group of each block with new pages, SIZE_MAX for blocks without new pages
+static std::array<size_t, num_blks> take_pages(ref_design_mod_loader &loader, bool is_downlink)
+{
+    std::array<size_t, num_blks> num_users{};
+    num_users.fill(SIZE_MAX);
+    loader.get_weight_pages(is_downlink, [&](size_t resource_blk_no, const auto &pages, const auto &keys) {
+        num_users[resource_blk_no] = pages[0] ? keys.num_keys[0] : 0;
+    });
+    return num_users;
+}
+
+//! Two grouped UE radios with pages for every block, and the pages taken
+static void start(test_csi_mod &mod, ref_design_mod_loader &loader)
+{
+    mod.add_ue_radio(1);
+    mod.add_ue_radio(2);
+    mod.enable_radios();
+    mod.send_csi_of_all_blocks(10);
+    mod.run_once();
+    take_pages(loader, true);
+    take_pages(loader, false);
+}
+
+TEST(TestRefDesignCsiMod, CalculatesEveryPageOnceThenIdles)
+{
+    auto loader = std::make_shared<ref_design_mod_loader>(scheduler_config());
+    test_csi_mod mod(loader.get(), scheduler_config(), mod_config());
+    mod.add_ue_radio(1);
+    mod.add_ue_radio(2);
+    mod.enable_radios();
+    mod.send_csi_of_all_blocks(10);
+    mod.run_once();
+
+    EXPECT_EQ(mod.stat("recomputed_pages"), 2*num_blks);
+    for (bool is_downlink : {false, true}) {
+        const auto num_users = take_pages(*loader, is_downlink);
+        for (size_t resource_blk_no = 0; resource_blk_no < num_blks; resource_blk_no++)
+            EXPECT_EQ(num_users[resource_blk_no], 2u);
+    }
+
+    EXPECT_FALSE(mod.run_once());
+    EXPECT_EQ(mod.stat("idle_runs"), 1u);
+    EXPECT_EQ(mod.stat("recomputed_pages"), 2*num_blks);
+    EXPECT_EQ(take_pages(*loader, true)[0], SIZE_MAX);
+}
+
+TEST(TestRefDesignCsiMod, CoalescesCsiOfOneDrain)
+{
+    auto loader = std::make_shared<ref_design_mod_loader>(scheduler_config());
+    test_csi_mod mod(loader.get(), scheduler_config(), mod_config());
+    start(mod, *loader);
+
+    // Only the newest CSI of each UE radio, block, and estimation is stored
+    mod.send_csi(11, 1, 0);
+    mod.send_csi(12, 1, 0);
+    mod.send_csi(13, 1, 0, 2.0f);
+    mod.run_once();
+    EXPECT_EQ(mod.stat("coalesced_csi"), 2*num_estimations);
+    EXPECT_EQ(mod.stat("recomputed_pages"), 2*num_blks + 2);
+}
+
+TEST(TestRefDesignCsiMod, OnlyRecalculatesDirtyPages)
+{
+    auto loader = std::make_shared<ref_design_mod_loader>(scheduler_config());
+    test_csi_mod mod(loader.get(), scheduler_config(), mod_config());
+    start(mod, *loader);
+    size_t recomputed = mod.stat("recomputed_pages");
+
+    // New CSI only changes the pages of its block
+    mod.send_csi(11, 2, 1);
+    mod.run_once();
+    EXPECT_EQ(mod.stat("recomputed_pages"), recomputed += 2);
+    auto num_users = take_pages(*loader, true);
+    EXPECT_EQ(num_users[0], SIZE_MAX);
+    EXPECT_EQ(num_users[1], 2u);
+
+    // A changed UE radio only changes the pages grouping it, UE radio 3 has no CSI and is in no group
+    mod.add_ue_radio(3);
+    mod.run_once();
+    EXPECT_EQ(mod.stat("recomputed_pages"), recomputed += 2*num_blks);
+    mod.change_ue_radio(3);
+    EXPECT_FALSE(mod.run_once());
+    EXPECT_EQ(mod.stat("recomputed_pages"), recomputed);
+    mod.change_ue_radio(1);
+    mod.run_once();
+    EXPECT_EQ(mod.stat("recomputed_pages"), recomputed += 2*num_blks);
+
+    // The groups of a removed UE radio are calculated without it
+    take_pages(*loader, true);
+    mod.remove_ue_radio(2);
+    mod.run_once();
+    EXPECT_EQ(mod.stat("recomputed_pages"), recomputed += 2*num_blks);
+    num_users = take_pages(*loader, true);
+    EXPECT_EQ(num_users[0], 1u);
+    EXPECT_EQ(num_users[1], 1u);
+}
+
+TEST(TestRefDesignCsiMod, ChangedStreamMarksThePagesOfItsUeRadio)
+{
+    auto loader = std::make_shared<ref_design_mod_loader>(scheduler_config());
+    test_csi_mod mod(loader.get(), scheduler_config(), mod_config());
+    start(mod, *loader);
+    mod.add_ue_radio(3);
+    mod.run_once();
+    size_t recomputed = mod.stat("recomputed_pages");
+
+    // Stream keys differ from UE radio keys, the stream is mapped to its UE radio, which is in no group
+    mod.change_ue_stream(100, 3);
+    EXPECT_FALSE(mod.run_once());
+    EXPECT_EQ(mod.stat("recomputed_pages"), recomputed);
+
+    mod.change_ue_stream(101, 1);
+    mod.run_once();
+    EXPECT_EQ(mod.stat("recomputed_pages"), recomputed += 2*num_blks);
+
+    // A stream of a UE radio the module has not seen could be in any group
+    mod.change_ue_stream(102, 4);
+    mod.run_once();
+    EXPECT_EQ(mod.stat("recomputed_pages"), recomputed += 2*num_blks);
+}
+
+//! Let the CSI of frame 10 expire after 5 frames while no CSI arrives, with time advanced by clock
+static void expect_withdrawn_when_csi_stops(std::atomic_size_t ref_design_mod_loader::*clock)
+{
+    auto loader = std::make_shared<ref_design_mod_loader>(scheduler_config());
+    auto config = mod_config();
+    config.max_csi_age_frames = 5;
+    test_csi_mod mod(loader.get(), scheduler_config(), config);
+    start(mod, *loader);
+
+    ((*loader).*clock).store(15);
+    EXPECT_FALSE(mod.run_once());
+    EXPECT_EQ(mod.stat("idle_runs"), 1u);
+    EXPECT_EQ(mod.stat("stale_drops"), 0u);
+
+    // Every group expired, so the pages of every block are withdrawn
+    ((*loader).*clock).store(16);
+    mod.run_once();
+    EXPECT_EQ(mod.stat("idle_runs"), 1u);
+    EXPECT_EQ(mod.stat("stale_drops"), 2*2*num_blks);
+    for (bool is_downlink : {false, true}) {
+        const auto num_users = take_pages(*loader, is_downlink);
+        for (size_t resource_blk_no = 0; resource_blk_no < num_blks; resource_blk_no++)
+            EXPECT_EQ(num_users[resource_blk_no], 0u);
+    }
+
+    // Nothing is left to expire
+    ((*loader).*clock).store(30);
+    EXPECT_FALSE(mod.run_once());
+    EXPECT_EQ(mod.stat("idle_runs"), 2u);
+}
+
+TEST(TestRefDesignCsiMod, WithdrawsGroupsWhenCsiStops)
+{
+    expect_withdrawn_when_csi_stops(&ref_design_mod_loader::last_schedule_frame_time);
+}
+
+TEST(TestRefDesignCsiMod, WithdrawsGroupsWhenOnlyOtherShardsGetCsi)
+{
+    // The router publishes the frame time of the CSI of every shard
+    expect_withdrawn_when_csi_stops(&ref_design_mod_loader::last_csi_frame_time);
+}
+
+TEST(TestRefDesignCsiMod, UnchangedGroupIsCopiedFromTheWeightCache)
+{
+    auto loader = std::make_shared<ref_design_mod_loader>(scheduler_config());
+    auto config = mod_config();
+    config.weight_cache_bytes = 16*ref_design_weight_cache::entry_bytes(num_estimations);
+    test_csi_mod mod(loader.get(), scheduler_config(), config);
+    start(mod, *loader);
+    EXPECT_EQ(mod.stat("weight_cache_misses"), 2*num_blks);
+
+    // The group and its CSI are unchanged, so the weights are copied
+    mod.change_ue_radio(1);
+    mod.run_once();
+    EXPECT_EQ(mod.stat("weight_cache_hits"), 2*num_blks);
+    EXPECT_EQ(take_pages(*loader, true)[0], 2u);
+
+    mod.send_csi(11, 1, 0, 2.0f);
+    mod.run_once();
+    EXPECT_EQ(mod.stat("weight_cache_hits"), 2*num_blks);
+    EXPECT_EQ(mod.stat("weight_cache_misses"), 2*num_blks + 2);
+}
+
+TEST(TestRefDesignCsiMod, ReusesPooledPagesInSteadyState)
+{
+    auto loader = std::make_shared<ref_design_mod_loader>(scheduler_config());
+    auto config = mod_config();
+    config.weight_pages_per_group = 3;
+    test_csi_mod mod(loader.get(), scheduler_config(), config);
+    mod.add_ue_radio(1);
+    mod.add_ue_radio(2);
+    mod.enable_radios();
+
+    // Like the schedule module, keep the latest pages of each block, taking them only every third frame
+    std::array<std::array<ref_design_weight_page_set, 2>, num_blks> scheduled{};
+    constexpr size_t num_frames{30};
+    for (size_t frame_time = 1; frame_time <= num_frames; frame_time++) {
+        mod.send_csi_of_all_blocks(frame_time);
+        mod.run_once();
+        if (frame_time%3)
+            continue;
+        for (bool is_downlink : {false, true}) {
+            loader->get_weight_pages(is_downlink, [&](size_t resource_blk_no, const auto &pages, const auto &keys [[maybe_unused]]) {
+                scheduled[resource_blk_no][is_downlink] = pages;
+            });
+        }
+    }
+
+    // Pages are only requested to fill the pools, after that every page is one of the pool
+    EXPECT_EQ(mod.stat("unpooled_pages"), 0u);
+    EXPECT_EQ(mod.stat("initialized_pages"), 3*2*num_blks);
+    EXPECT_EQ(mod.new_pages, 3*2*num_blks);
+    EXPECT_EQ(mod.stat("reused_weight_pages"), (num_frames - 3)*2*num_blks);
+}
+
+TEST(TestRefDesignCsiMod, RouterForwardsToTheShardOwningTheBlock)
+{
+    auto loader = std::make_shared<ref_design_mod_loader>(scheduler_config());
+    std::vector<std::shared_ptr<test_csi_mod>> shards{};
+    for (size_t shard_no = 0; shard_no < num_blks; shard_no++) {
+        shards.push_back(std::make_shared<test_csi_mod>(loader.get(), scheduler_config(), mod_config(), shard_no, num_blks));
+        shards.back()->add_ue_radio(1);
+        shards.back()->enable_radios();
+    }
+    test_csi_router router(loader.get(), mod_config(), num_blks, {shards.begin(), shards.end()});
+
+    for (size_t resource_blk_no = 0; resource_blk_no < num_blks; resource_blk_no++) {
+        for (size_t est_idx = 0; est_idx < num_estimations; est_idx++)
+            router.send_csi({20 + resource_blk_no, 1, sklk_phy_ue_radio{}, resource_blk_no, est_idx, test_csi_mod::csi(1, 1.0f)});
+    }
+    router.run_once();
+    EXPECT_EQ(router.dump_stats().at("routed_csi").get<size_t>(), num_blks*num_estimations);
+    EXPECT_EQ(loader->last_csi_frame_time.load(), 20 + num_blks - 1);
+
+    for (size_t shard_no = 0; shard_no < num_blks; shard_no++) {
+        shards[shard_no]->run_once();
+        EXPECT_EQ(shards[shard_no]->stat("recomputed_pages"), 2u);
+        const auto num_users = take_pages(*loader, true);
+        for (size_t resource_blk_no = 0; resource_blk_no < num_blks; resource_blk_no++)
+            EXPECT_EQ(num_users[resource_blk_no], resource_blk_no == shard_no ? 1u : SIZE_MAX);
+    }
+}
@@ -0,0 +1,166 @@
+#include <sklk-cpptest.hpp>
+
+#include "csi_store.hpp"
+
+#include <cstdint>
+#include <set>
+
+TEST(TestRefDesignCsiStore, AllocatesUntilFull)
+{
+    ref_design_csi_store store(2, 2, 3);
+    store.allocate_arenas();
+    std::set<size_t> slots{};
+    for (size_t i = 0; i < store.num_slots(); i++)
+        slots.insert(store.allocate());
+    EXPECT_EQ(slots.size(), 3u);
+    EXPECT_EQ(slots.count(ref_design_csi_store::invalid_slot), 0u);
+    EXPECT_EQ(store.allocate(), ref_design_csi_store::invalid_slot);
+
+    store.release(1);
+    EXPECT_EQ(store.allocate(), 1u);
+}
+
+TEST(TestRefDesignCsiStore, GrowsWhenFullAndKeepsCsi)
+{
+    ref_design_csi_store store(2, 2, 2);
+    store.allocate_arenas();
+    EXPECT_FALSE(store.grow());
+    const size_t a = store.allocate();
+    const size_t b = store.allocate();
+    EXPECT_EQ(store.allocate(), ref_design_csi_store::invalid_slot);
+
+    sklk_phy_csi_vec csi{};
+    for (size_t radio = 0; radio < SKLK_PHY_MAX_RADIOS; radio++)
+        csi[radio] = {float(radio), 1.0f};
+    store.set_csi(1, 1, b, 7, csi);
+    store.set_calibration(1, 1, 3, {2.0f, 0.0f});
+    const sklk_mii_cf_t calibrated = store.calibrated_csi(1, 1, b)[3];
+
+    EXPECT_TRUE(store.grow());
+    EXPECT_EQ(store.num_slots(), 4u);
+    EXPECT_EQ(store.allocate(), 2u);
+    EXPECT_EQ(store.allocate(), 3u);
+    EXPECT_EQ(store.allocate(), ref_design_csi_store::invalid_slot);
+
+    EXPECT_FALSE(store.is_valid(1, 1, a));
+    EXPECT_TRUE(store.is_valid(1, 1, b));
+    EXPECT_FALSE(store.is_valid(1, 1, 2));
+    EXPECT_EQ(store.frame_time(1, 1, b), 7u);
+    EXPECT_EQ(store.version(1, 1, b), 1u);
+    EXPECT_EQ(store.calibrated_csi(1, 1, b)[3], calibrated);
+    for (size_t radio = 0; radio < SKLK_PHY_MAX_RADIOS; radio++)
+        EXPECT_EQ(store.csi(1, 1, b)[radio], csi[radio]);
+}
+
+TEST(TestRefDesignCsiStore, RowsAreAlignedAndIndependent)
+{
+    ref_design_csi_store store(2, 2, 3);
+    store.allocate_arenas();
+    const size_t a = store.allocate();
+    const size_t b = store.allocate();
+
+    sklk_phy_csi_vec csi{};
+    for (size_t radio = 0; radio < SKLK_PHY_MAX_RADIOS; radio++)
+        csi[radio] = {float(radio), -float(radio)};
+    store.set_csi(1, 0, a, 10, csi);
+
+    EXPECT_EQ(reinterpret_cast<uintptr_t>(store.csi(1, 0, a)) % 64, 0u);
+    EXPECT_EQ(reinterpret_cast<uintptr_t>(store.csi(1, 0, b)) % 64, 0u);
+    EXPECT_TRUE(store.is_valid(1, 0, a));
+    EXPECT_FALSE(store.is_valid(1, 0, b));
+    EXPECT_FALSE(store.is_valid(0, 0, a));
+    EXPECT_EQ(store.frame_time(1, 0, a), 10u);
+    EXPECT_EQ(store.version(1, 0, a), 1u);
+    for (size_t radio = 0; radio < SKLK_PHY_MAX_RADIOS; radio++)
+        EXPECT_EQ(store.csi(1, 0, a)[radio], csi[radio]);
+
+    EXPECT_FALSE(store.ready(1, a));
+    store.set_csi(1, 1, a, 11, csi);
+    EXPECT_TRUE(store.ready(1, a));
+}
+
+TEST(TestRefDesignCsiStore, ReallocatedSlotStartsInvalid)
+{
+    ref_design_csi_store store(1, 1, 1);
+    store.allocate_arenas();
+    const size_t slot = store.allocate();
+    store.set_csi(0, 0, slot, 5, sklk_phy_csi_vec{});
+    const uint64_t version = store.version(0, 0, slot);
+    store.release(slot);
+
+    EXPECT_EQ(store.allocate(), slot);
+    EXPECT_FALSE(store.ready(0, slot));
+    store.set_csi(0, 0, slot, 6, sklk_phy_csi_vec{});
+    EXPECT_GT(store.version(0, 0, slot), version);
+}
+
+TEST(TestRefDesignCsiStore, ReadyRejectsOldCsi)
+{
+    ref_design_csi_store store(1, 2, 1);
+    store.allocate_arenas();
+    const size_t slot = store.allocate();
+    store.set_csi(0, 0, slot, 100, sklk_phy_csi_vec{});
+    store.set_csi(0, 1, slot, 120, sklk_phy_csi_vec{});
+
+    EXPECT_EQ(store.oldest_frame_time(0, slot), 100u);
+    EXPECT_TRUE(store.ready(0, slot, 100));
+    EXPECT_FALSE(store.ready(0, slot, 101));
+}
+
+TEST(TestRefDesignCsiStore, CalibratedCsiFollowsCsiAndCalibration)
+{
+    ref_design_csi_store store(2, 2, 3);
+    store.allocate_arenas();
+    const size_t a = store.allocate();
+    const size_t b = store.allocate();
+
+    sklk_phy_csi_vec csi{};
+    for (size_t radio = 0; radio < SKLK_PHY_MAX_RADIOS; radio++)
+        csi[radio] = {float(radio + 1), 0.0f};
+    store.set_csi(1, 0, a, 10, csi);
+    EXPECT_EQ(store.calibrated_csi(1, 0, a)[0], sklk_mii_cf_t{});
+
+    // Calibration rescales the CSI already set, and applies to CSI set later
+    store.set_calibration(1, 0, 2, {0.0f, 2.0f});
+    EXPECT_EQ(store.calibrated_csi(1, 0, a)[2], sklk_mii_cf_t(0.0f, 6.0f));
+    EXPECT_EQ(store.calibrated_csi(1, 0, a)[1], sklk_mii_cf_t{});
+    store.set_csi(1, 0, b, 11, csi);
+    EXPECT_EQ(store.calibrated_csi(1, 0, b)[2], sklk_mii_cf_t(0.0f, 6.0f));
+    EXPECT_EQ(store.calibrated_csi(1, 1, b)[2], sklk_mii_cf_t{});
+    EXPECT_EQ(store.csi(1, 0, b)[2], sklk_mii_cf_t(3.0f, 0.0f));
+}
+
+TEST(TestRefDesignCsiStore, ChangeThresholdComparesWithLastMaterialChange)
+{
+    ref_design_csi_store store(1, 1, 2, 0.1f);
+    store.allocate_arenas();
+    const size_t a = store.allocate();
+
+    sklk_phy_csi_vec csi{};
+    csi.fill({1.0f, 0.0f});
+    EXPECT_TRUE(store.set_csi(0, 0, a, 1, csi));
+
+    // Small steps are stored but are not material until they add up to the threshold
+    csi.fill({1.06f, 0.0f});
+    EXPECT_FALSE(store.set_csi(0, 0, a, 2, csi));
+    EXPECT_EQ(store.csi(0, 0, a)[0], sklk_mii_cf_t(1.06f, 0.0f));
+    EXPECT_EQ(store.frame_time(0, 0, a), 2u);
+    csi.fill({1.12f, 0.0f});
+    EXPECT_TRUE(store.set_csi(0, 0, a, 3, csi));
+    csi.fill({1.15f, 0.0f});
+    EXPECT_FALSE(store.set_csi(0, 0, a, 4, csi));
+    EXPECT_EQ(store.version(0, 0, a), 4u);
+    EXPECT_EQ(store.material_version(0, 0, a), 2u);
+
+    // A reused slot starts over
+    store.release(a);
+    EXPECT_EQ(store.allocate(), a);
+    EXPECT_TRUE(store.set_csi(0, 0, a, 5, csi));
+
+    ref_design_csi_store always(1, 1, 1);
+    always.allocate_arenas();
+    const size_t b = always.allocate();
+    EXPECT_TRUE(always.set_csi(0, 0, b, 1, csi));
+    EXPECT_TRUE(always.set_csi(0, 0, b, 2, csi));
+    EXPECT_EQ(always.material_version(0, 0, b), always.version(0, 0, b));
+}
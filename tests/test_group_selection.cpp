@@ -0,0 +1,82 @@
+#include <sklk-cpptest.hpp>
+
+#include "group_selection.hpp"
+
+#include <algorithm>
+#include <random>
+#include <vector>
+
+static constexpr size_t num_radios{16};
+
+//! Candidates 0 and 1 share a channel, candidate 2 is orthogonal to both and weaker
+static void load_correlated(ref_design_group_selector &selector)
+{
+    selector.reset(3, num_radios);
+    for (size_t candidate = 0; candidate < 3; candidate++)
+        std::fill(selector.channel(candidate), selector.channel(candidate) + num_radios, sklk_mii_cf_t{});
+    for (size_t radio = 0; radio < num_radios/2; radio++) {
+        selector.channel(0)[radio] = {2.0f, 0.0f};
+        selector.channel(1)[radio] = {0.0f, 2.0f};
+        selector.channel(2)[radio + num_radios/2] = {1.0f, 0.0f};
+    }
+}
+
+TEST(TestRefDesignGroupSelection, ParsesNames)
+{
+    ref_design_group_selection selection{};
+    for (auto expected : {ref_design_group_selection::random, ref_design_group_selection::sus,
+                          ref_design_group_selection::greedy}) {
+        EXPECT_TRUE(from_string(to_string(expected), selection));
+        EXPECT_EQ(selection, expected);
+    }
+    EXPECT_FALSE(from_string("round_robin", selection));
+}
+
+TEST(TestRefDesignGroupSelection, RandomIsCappedAtMaxUsers)
+{
+    std::mt19937 randomizer(1);
+    ref_design_group_selector selector(ref_design_group_selection::random, 0.5f, 20.0f);
+    std::vector<size_t> selected;
+
+    selector.reset(10, num_radios);
+    selector.select(4, randomizer, selected);
+    EXPECT_EQ(selected.size(), 4u);
+    std::sort(selected.begin(), selected.end());
+    EXPECT_TRUE(std::adjacent_find(selected.begin(), selected.end()) == selected.end());
+    EXPECT_LT(selected.back(), 10u);
+
+    selector.reset(3, num_radios);
+    selector.select(4, randomizer, selected);
+    EXPECT_EQ(selected.size(), 3u);
+}
+
+TEST(TestRefDesignGroupSelection, SusSkipsCorrelatedUsers)
+{
+    std::mt19937 randomizer(2);
+    ref_design_group_selector selector(ref_design_group_selection::sus, 0.5f, 20.0f);
+    std::vector<size_t> selected;
+
+    load_correlated(selector);
+    selector.select(3, randomizer, selected);
+    ASSERT_EQ(selected.size(), 2u);
+    EXPECT_EQ(selected[0], 0u);
+    EXPECT_EQ(selected[1], 2u);
+}
+
+TEST(TestRefDesignGroupSelection, GreedyPrefersOrthogonalUsers)
+{
+    std::mt19937 randomizer(3);
+    ref_design_group_selector selector(ref_design_group_selection::greedy, 0.5f, 20.0f);
+    std::vector<size_t> selected;
+
+    load_correlated(selector);
+    selector.select(2, randomizer, selected);
+    ASSERT_EQ(selected.size(), 2u);
+    EXPECT_EQ(selected[0], 0u);
+    EXPECT_EQ(selected[1], 2u);
+
+    // Adding the user with no gain left would only split the power
+    load_correlated(selector);
+    selector.select(3, randomizer, selected);
+    EXPECT_EQ(selected.size(), 2u);
+}
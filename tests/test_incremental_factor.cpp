@@ -0,0 +1,66 @@
+#include <sklk-cpptest.hpp>
+
+#include "incremental_factor.hpp"
+
+#include <random>
+#include <vector>
+
+static constexpr size_t num_radios{24};
+
+using channel_t = std::vector<std::vector<std::complex<float>>>;
+
+static void load(ref_design_zf_batch &batch, size_t problem, const channel_t &channel, const std::vector<size_t> &keys)
+{
+    batch.set_num_users(problem, keys.size());
+    for (size_t user = 0; user < keys.size(); user++) {
+        for (size_t radio = 0; radio < num_radios; radio++) {
+            batch.a_re(problem, user)[radio] = channel[keys[user]][radio].real();
+            batch.a_im(problem, user)[radio] = channel[keys[user]][radio].imag();
+        }
+    }
+}
+
+TEST(TestRefDesignIncrementalFactor, UpdateMatchesFullFactorization)
+{
+    std::mt19937 generator(4);
+    std::normal_distribution<float> distr(0.0f, 1.0f);
+    channel_t channel(10, std::vector<std::complex<float>>(num_radios));
+    for (auto &row : channel)
+        for (auto &value : row)
+            value = {distr(generator), distr(generator)};
+
+    const std::vector<uint64_t> versions(8, 1);
+    const std::vector<size_t> before{0, 1, 2, 3, 4, 5};
+    // Users 1 and 4 leave, users 7 and 8 join
+    const std::vector<size_t> after{0, 2, 3, 5, 7, 8};
+
+    ref_design_zf_batch batch;
+    batch.resize(2, 8, num_radios);
+    load(batch, 0, channel, before);
+    batch.solve(0, 1, 0.0f);
+    ASSERT_TRUE(batch.ok(0));
+
+    ref_design_incremental_factor factor(8);
+    factor.assign(before.data(), versions.data(), before.size(), 0, batch, 0);
+
+    // A changed CSI version or inputs version requires a full factorization
+    std::vector<uint64_t> changed(versions);
+    changed[1] = 2;
+    load(batch, 0, channel, after);
+    EXPECT_FALSE(factor.update(after.data(), changed.data(), after.size(), 0, batch, 0, ref_design_complex_kernels::best(), 1e-3));
+    EXPECT_FALSE(factor.update(after.data(), versions.data(), after.size(), 1, batch, 0, ref_design_complex_kernels::best(), 1e-3));
+
+    ASSERT_TRUE(factor.update(after.data(), versions.data(), after.size(), 0, batch, 0, ref_design_complex_kernels::best(), 1e-3));
+    EXPECT_EQ(factor.num_users(), after.size());
+
+    load(batch, 1, channel, after);
+    batch.solve(1, 1, 0.0f);
+    ASSERT_TRUE(batch.ok(1));
+
+    for (size_t user = 0; user < after.size(); user++) {
+        for (size_t radio = 0; radio < num_radios; radio++) {
+            EXPECT_NEAR(batch.x_re(0, user)[radio], batch.x_re(1, user)[radio], 1e-4);
+            EXPECT_NEAR(batch.x_im(0, user)[radio], batch.x_im(1, user)[radio], 1e-4);
+        }
+    }
+}
@@ -0,0 +1,75 @@
+#include <sklk-cpptest.hpp>
+
+#include "pf_table.hpp"
+
+#include <cmath>
+
+TEST(TestRefDesignPfTable, UnservedStreamsWin)
+{
+    ref_design_pf_table table(4, 0.5f);
+    const uint16_t a = table.index(10);
+    const uint16_t b = table.index(20);
+    EXPECT_EQ(table.index(10), a);
+    EXPECT_NE(a, b);
+
+    table.serve(&a, 1);
+    table.update(1);
+    EXPECT_FLOAT_EQ(table.avg_rate(a), 0.5f);
+    EXPECT_FLOAT_EQ(table.avg_rate(b), 0.0f);
+    EXPECT_GT(table.metric(&b, 1), table.metric(&a, 1));
+
+    // Serving b in half of the blocks raises its rate by half as much
+    table.serve(&b, 1);
+    table.update(2);
+    EXPECT_FLOAT_EQ(table.avg_rate(a), 0.25f);
+    EXPECT_FLOAT_EQ(table.avg_rate(b), 0.25f);
+}
+
+TEST(TestRefDesignPfTable, ReleaseFreesEntries)
+{
+    ref_design_pf_table table(2, 0.5f);
+    const uint16_t a = table.index(1);
+    const uint16_t b = table.index(2);
+    EXPECT_EQ(table.index(3), ref_design_pf_table::invalid_index);
+    EXPECT_EQ(table.find(2), b);
+
+    table.release(b);
+    table.release(b);
+    EXPECT_EQ(table.find(2), ref_design_pf_table::invalid_index);
+    const uint16_t c = table.index(3);
+    EXPECT_EQ(c, b);
+    EXPECT_EQ(table.index(1), a);
+    EXPECT_EQ(table.index(4), ref_design_pf_table::invalid_index);
+}
+
+TEST(TestRefDesignPfTable, FindsKeysAfterReleases)
+{
+    // Enough keys that some share a probe sequence
+    ref_design_pf_table table(64, 0.5f);
+    for (size_t key = 0; key < 64; key++)
+        ASSERT_NE(table.index(key*1000), ref_design_pf_table::invalid_index);
+    for (size_t key = 0; key < 64; key += 2)
+        table.release(table.find(key*1000));
+    for (size_t key = 0; key < 64; key++) {
+        if (key % 2)
+            EXPECT_NE(table.find(key*1000), ref_design_pf_table::invalid_index);
+        else
+            EXPECT_EQ(table.find(key*1000), ref_design_pf_table::invalid_index);
+    }
+}
+
+TEST(TestRefDesignPfTable, DecaysAcrossRenormalization)
+{
+    ref_design_pf_table table(2, 0.5f);
+    const uint16_t a = table.index(1);
+    table.serve(&a, 1);
+    table.update(1);
+    // Long enough that the stored rates are renormalized on the way
+    for (size_t i = 0; i < 100; i++)
+        table.update(1);
+    EXPECT_FLOAT_EQ(table.avg_rate(a), 0.5f*std::pow(0.5f, 100.0f));
+
+    table.serve(&a, 1);
+    table.update(1);
+    EXPECT_FLOAT_EQ(table.avg_rate(a), 0.5f + 0.25f*std::pow(0.5f, 100.0f));
+}
@@ -0,0 +1,45 @@
+#include <sklk-cpptest.hpp>
+
+#include "thread_policy.hpp"
+
+#include <sched.h>
+
+TEST(TestRefDesignThreadPolicy, ParseCpuList)
+{
+    EXPECT_EQ(ref_design_parse_cpu_list(""), std::vector<int>{});
+    EXPECT_EQ(ref_design_parse_cpu_list("3"), std::vector<int>{3});
+    EXPECT_EQ(ref_design_parse_cpu_list("0-2,8,10-11\n"), (std::vector<int>{0, 1, 2, 8, 10, 11}));
+}
+
+TEST(TestRefDesignThreadPolicy, JsonRoundTrip)
+{
+    ref_design_thread_policy policy = nlohmann::json{{"cpus", {2, 3}}, {"fifo_priority", 50}, {"require_isolated", true}};
+    EXPECT_EQ(policy.cpus, (std::vector<int>{2, 3}));
+    EXPECT_EQ(policy.fifo_priority, 50);
+    EXPECT_EQ(policy.numa_node, -1);
+    EXPECT_TRUE(policy.require_isolated);
+
+    const nlohmann::json j = policy;
+    EXPECT_EQ(j.get<ref_design_thread_policy>().cpus, policy.cpus);
+    EXPECT_THROW(nlohmann::json({{"fifo_priority", 100}}).get<ref_design_thread_policy>(), std::invalid_argument);
+    EXPECT_THROW(nlohmann::json({{"cpus", {-1}}}).get<ref_design_thread_policy>(), std::invalid_argument);
+    EXPECT_THROW(nlohmann::json({{"cpus", {CPU_SETSIZE}}}).get<ref_design_thread_policy>(), std::invalid_argument);
+    EXPECT_THROW(nlohmann::json({{"numa_node", 64}}).get<ref_design_thread_policy>(), std::invalid_argument);
+}
+
+TEST(TestRefDesignThreadPolicy, PinGivesEachThreadItsOwnCpu)
+{
+    ref_design_thread_policy policy = nlohmann::json{{"cpus", {4, 5, 6}}, {"fifo_priority", 50}};
+    EXPECT_EQ(ref_design_pin_thread_policy(policy, 0).cpus, std::vector<int>{4});
+    EXPECT_EQ(ref_design_pin_thread_policy(policy, 2).cpus, std::vector<int>{6});
+    EXPECT_EQ(ref_design_pin_thread_policy(policy, 2).fifo_priority, 50);
+    EXPECT_TRUE(ref_design_pin_thread_policy(ref_design_thread_policy{}, 1).cpus.empty());
+}
+
+TEST(TestRefDesignThreadPolicy, DefaultPolicyReportsPlacement)
+{
+    const auto placement = ref_design_apply_thread_policy("test", ref_design_thread_policy{}, 0.0);
+    EXPECT_FALSE(placement.cpus.empty());
+    EXPECT_NE(placement.cpu, -1);
+    EXPECT_EQ(placement.numa_node, -1);
+}
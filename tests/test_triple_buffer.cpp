@@ -0,0 +1,53 @@
+#include <sklk-cpptest.hpp>
+
+#include "triple_buffer.hpp"
+
+#include <thread>
+
+TEST(TestRefDesignTripleBuffer, ReaderSeesLatestValue)
+{
+    ref_design_triple_buffer<int> buffer;
+    EXPECT_FALSE(buffer.update());
+
+    buffer.back() = 1;
+    EXPECT_FALSE(buffer.publish());
+    buffer.back() = 2;
+    EXPECT_TRUE(buffer.publish());
+
+    EXPECT_TRUE(buffer.update());
+    EXPECT_EQ(buffer.front(), 2);
+    EXPECT_FALSE(buffer.update());
+    EXPECT_EQ(buffer.front(), 2);
+
+    buffer.back() = 3;
+    EXPECT_FALSE(buffer.publish());
+}
+
+TEST(TestRefDesignTripleBuffer, ValuesAreNeverTorn)
+{
+    struct value
+    {
+        size_t a;
+        size_t b;
+    };
+    static constexpr size_t num_values{200000};
+    ref_design_triple_buffer<value> buffer;
+
+    std::thread writer([&] {
+        for (size_t i = 1; i <= num_values; i++) {
+            buffer.back() = {i, ~i};
+            buffer.publish();
+        }
+    });
+
+    size_t last{0};
+    while (last < num_values) {
+        if (not buffer.update())
+            continue;
+        const auto &front = buffer.front();
+        ASSERT_EQ(front.b, ~front.a);
+        ASSERT_GT(front.a, last);
+        last = front.a;
+    }
+    writer.join();
+}
@@ -0,0 +1,65 @@
+#include <sklk-cpptest.hpp>
+
+#include "weight_cache.hpp"
+
+#include <cstdint>
+
+TEST(TestRefDesignWeightCache, CapacityFollowsMemoryCap)
+{
+    const size_t entry_bytes = ref_design_weight_cache::entry_bytes(2);
+    EXPECT_EQ(ref_design_weight_cache(0, 2).capacity(), 0u);
+    EXPECT_EQ(ref_design_weight_cache(entry_bytes - 1, 2).capacity(), 0u);
+    EXPECT_EQ(ref_design_weight_cache(3*entry_bytes + 1, 2).capacity(), 3u);
+
+    ref_design_weight_cache disabled(0, 2);
+    const size_t ue_keys[] = {1};
+    const uint64_t csi_versions[] = {1, 1};
+    const ref_design_weight_cache_key key{0, true, 0, ue_keys, csi_versions, 1};
+    EXPECT_EQ(disabled.insert(key), ref_design_weight_cache::invalid_entry);
+    EXPECT_EQ(disabled.find(key), ref_design_weight_cache::invalid_entry);
+}
+
+TEST(TestRefDesignWeightCache, FindsGroupInAnyOrder)
+{
+    ref_design_weight_cache cache(4*ref_design_weight_cache::entry_bytes(2), 2);
+    const size_t ue_keys[] = {7, 3};
+    // [est_idx][userno]
+    const uint64_t csi_versions[] = {10, 20, 11, 21};
+    const size_t entry = cache.insert({5, true, 1, ue_keys, csi_versions, 2});
+    ASSERT_NE(entry, ref_design_weight_cache::invalid_entry);
+    cache.weights(entry, 7, 1)[0] = {1.0f, 2.0f};
+    cache.weights(entry, 3, 1)[0] = {3.0f, 4.0f};
+
+    const size_t swapped_keys[] = {3, 7};
+    const uint64_t swapped_versions[] = {20, 10, 21, 11};
+    EXPECT_EQ(cache.find({5, true, 1, swapped_keys, swapped_versions, 2}), entry);
+    EXPECT_EQ(cache.weights(entry, 7, 1)[0], sklk_mii_cf_t(1.0f, 2.0f));
+    EXPECT_EQ(cache.weights(entry, 3, 1)[0], sklk_mii_cf_t(3.0f, 4.0f));
+
+    // Any changed input misses
+    const uint64_t new_versions[] = {20, 10, 22, 11};
+    EXPECT_EQ(cache.find({5, true, 1, swapped_keys, new_versions, 2}), ref_design_weight_cache::invalid_entry);
+    EXPECT_EQ(cache.find({5, true, 2, swapped_keys, swapped_versions, 2}), ref_design_weight_cache::invalid_entry);
+    EXPECT_EQ(cache.find({5, false, 1, swapped_keys, swapped_versions, 2}), ref_design_weight_cache::invalid_entry);
+    EXPECT_EQ(cache.find({4, true, 1, swapped_keys, swapped_versions, 2}), ref_design_weight_cache::invalid_entry);
+    EXPECT_EQ(cache.find({5, true, 1, swapped_keys, swapped_versions, 1}), ref_design_weight_cache::invalid_entry);
+}
+
+TEST(TestRefDesignWeightCache, EvictsLeastRecentlyUsed)
+{
+    ref_design_weight_cache cache(2*ref_design_weight_cache::entry_bytes(1), 1);
+    const size_t keys[] = {1, 2, 3};
+    const uint64_t csi_versions[] = {1};
+    const ref_design_weight_cache_key a{0, true, 0, keys, csi_versions, 1};
+    const ref_design_weight_cache_key b{0, true, 0, keys + 1, csi_versions, 1};
+    const ref_design_weight_cache_key c{0, true, 0, keys + 2, csi_versions, 1};
+
+    const size_t entry_a = cache.insert(a);
+    cache.insert(b);
+    // Using a makes b the least recently used
+    EXPECT_EQ(cache.find(a), entry_a);
+    cache.insert(c);
+    EXPECT_EQ(cache.find(a), entry_a);
+    EXPECT_EQ(cache.find(b), ref_design_weight_cache::invalid_entry);
+    EXPECT_NE(cache.find(c), ref_design_weight_cache::invalid_entry);
+}
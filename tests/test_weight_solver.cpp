@@ -0,0 +1,60 @@
+#include <sklk-cpptest.hpp>
+
+#include "arma.hpp"
+#include "weight_solver.hpp"
+
+#include <cmath>
+#include <random>
+
+static arma::Mat<sklk_mii_cf_t> random_channel(size_t num_users, size_t num_radios, std::mt19937 &generator)
+{
+    std::normal_distribution<float> distr(0.0f, 1.0f);
+    arma::Mat<sklk_mii_cf_t> A(num_users, num_radios);
+    for (size_t user = 0; user < num_users; user++) {
+        for (size_t radio = 0; radio < num_radios; radio++)
+            A(user, radio) = {distr(generator), distr(generator)};
+    }
+    return A;
+}
+
+static double relative_error(const arma::Mat<sklk_mii_cf_t> &B, const arma::Mat<sklk_mii_cf_t> &expected)
+{
+    return arma::norm(B - expected, "fro")/arma::norm(expected, "fro");
+}
+
+TEST(TestRefDesignWeightSolver, CholeskyMatchesPinvOnWellConditionedChannel)
+{
+    std::mt19937 generator(1);
+    const auto A = random_channel(4, 16, generator);
+
+    arma::Mat<sklk_mii_cf_t> expected;
+    ASSERT_TRUE(ref_design_solve_weights(expected, A, ref_design_weight_solver::pinv_std, 0.0f));
+
+    arma::Mat<sklk_mii_cf_t> B;
+    ASSERT_TRUE(ref_design_solve_weights(B, A, ref_design_weight_solver::zf_cholesky, 0.0f));
+    EXPECT_LT(relative_error(B, expected), 1e-4);
+    // A small lambda only moves the weights a little
+    ASSERT_TRUE(ref_design_solve_weights(B, A, ref_design_weight_solver::rzf, 1e-4f));
+    EXPECT_LT(relative_error(B, expected), 1e-2);
+}
+
+TEST(TestRefDesignWeightSolver, CholeskyFallsBackToPinvOnRankDeficientChannel)
+{
+    std::mt19937 generator(2);
+    auto A = random_channel(4, 16, generator);
+    // Two users with the same channel make the Gram matrix singular
+    for (size_t radio = 0; radio < A.n_cols; radio++)
+        A(3, radio) = A(0, radio);
+
+    arma::Mat<sklk_mii_cf_t> expected;
+    ASSERT_TRUE(ref_design_solve_weights(expected, A, ref_design_weight_solver::pinv_std, 0.0f));
+
+    arma::Mat<sklk_mii_cf_t> B;
+    ASSERT_TRUE(ref_design_solve_weights(B, A, ref_design_weight_solver::zf_cholesky, 0.0f));
+    EXPECT_LT(relative_error(B, expected), 1e-3);
+
+    // The regularized Gram matrix stays positive definite, and the weights stay bounded
+    ASSERT_TRUE(ref_design_solve_weights(B, A, ref_design_weight_solver::rzf, 0.01f));
+    EXPECT_TRUE(std::isfinite(arma::norm(B, "fro")));
+    EXPECT_LT(arma::norm(B, "fro"), 10*arma::norm(expected, "fro"));
+}
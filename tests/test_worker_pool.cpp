@@ -0,0 +1,46 @@
+#include <sklk-cpptest.hpp>
+
+#include "worker_pool.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+TEST(TestRefDesignWorkerPool, RunsEveryJobOnce)
+{
+    for (size_t num_threads : {0, 1, 3}) {
+        ref_design_worker_pool pool(num_threads, {});
+        for (size_t num_jobs : {0, 1, 7, 64, 1000}) {
+            std::vector<std::atomic_int> counts(num_jobs);
+            pool.run(num_jobs, [&](size_t job_no) { counts[job_no]++; });
+            for (const auto &count : counts)
+                EXPECT_EQ(count.load(), 1);
+        }
+    }
+}
+
+TEST(TestRefDesignWorkerPool, BatchesAreSeparated)
+{
+    ref_design_worker_pool pool(2, {});
+    std::atomic_size_t total{0};
+    for (size_t batch = 0; batch < 100; batch++) {
+        size_t before = total;
+        pool.run(batch, [&](size_t) { total++; });
+        EXPECT_EQ(total.load(), before + batch);
+    }
+}
+
+TEST(TestRefDesignWorkerPool, WaitsForJobsTakenByWorkers)
+{
+    // The caller runs out of jobs long before the workers complete theirs and has to wait for them
+    ref_design_worker_pool pool(2, {});
+    std::atomic_size_t done{0};
+    for (size_t batch = 0; batch < 10; batch++) {
+        pool.run(3, [&](size_t) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(2));
+            done++;
+        });
+        EXPECT_EQ(done.load(), 3*(batch + 1));
+    }
+}